@@ -13,6 +13,7 @@ const TransitionEditorScene := preload("res://addons/EzFsm/scenes/transition_edi
 const DefaultColor = Color.INDIAN_RED
 
 @export var state: State: set=set_state
+var machine: StateMachine
 
 var _attacher: ScriptAttacher
 
@@ -147,8 +148,8 @@ func _on_color_button_toggled(toggle: bool) -> void:
 	size = Vector2.ZERO
 
 func _on_default_requested() -> void:
-	if state:
-		state.get_state_machine().default_state = state
+	if state and machine:
+		machine.default_state = state
 	rebuild_requested.emit()
 
 
@@ -86,6 +86,7 @@ func _build() -> void:
 
 	for state: State in machine.get_all_states():
 		var s_editor := StateEditorScene.instantiate()
+		s_editor.machine = machine
 		s_editor.state = state
 		add_child(s_editor)
 		s_editor.position_offset = state._node_position
@@ -0,0 +1,100 @@
+#ifndef __GDMPSCQUEUE_H__
+#define __GDMPSCQUEUE_H__
+
+#include <atomic>
+#include <stdint.h>
+
+#include <godot_cpp/core/memory.hpp>
+
+namespace godot::ez_fsm {
+
+// Bounded lock-free queue that any number of threads can push to and a single thread pops from.  Each cell
+// carries a sequence number telling producers and the consumer whose turn it is, so no locks are needed and
+// a full queue is reported instead of growing.  The capacity is rounded up to a power of two.
+template <typename T>
+class MPSCQueue {
+    struct Cell {
+        std::atomic<uint32_t> sequence;
+        T data;
+    };
+
+    Cell *cells = nullptr;
+    uint32_t capacity = 0;
+    uint32_t mask = 0;
+    std::atomic<uint32_t> enqueue_pos{ 0 };
+    uint32_t dequeue_pos = 0; // only touched by the consumer
+
+public:
+    // safe to call from any thread, returns false when the queue is full
+    bool push(const T &p_value) {
+        Cell *cell = nullptr;
+        uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & mask];
+            int32_t diff = int32_t(cell->sequence.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = p_value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer thread only, returns false when the queue is empty
+    bool pop(T &r_value) {
+        Cell *cell = &cells[dequeue_pos & mask];
+        if (int32_t(cell->sequence.load(std::memory_order_acquire) - (dequeue_pos + 1)) < 0) {
+            return false;
+        }
+
+        r_value = cell->data;
+        cell->data = T();
+        cell->sequence.store(dequeue_pos + capacity, std::memory_order_release);
+        ++dequeue_pos;
+        return true;
+    }
+
+    // not thread safe: only call while no other thread can push, whatever is still queued is dropped
+    void resize(uint32_t p_capacity) {
+        uint32_t size = 2;
+        while (size < p_capacity) {
+            size <<= 1;
+        }
+
+        if (nullptr != cells) {
+            memdelete_arr(cells);
+        }
+        cells = memnew_arr(Cell, size);
+        capacity = size;
+        mask = size - 1;
+        for (uint32_t idx = 0; idx < size; ++idx) {
+            cells[idx].sequence.store(idx, std::memory_order_relaxed);
+        }
+        enqueue_pos.store(0, std::memory_order_relaxed);
+        dequeue_pos = 0;
+    }
+
+    uint32_t get_capacity() const {
+        return capacity;
+    }
+
+    MPSCQueue(uint32_t p_capacity) {
+        resize(p_capacity);
+    }
+
+    ~MPSCQueue() {
+        memdelete_arr(cells);
+    }
+};
+
+}
+
+#endif
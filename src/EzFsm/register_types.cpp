@@ -3,9 +3,13 @@
 #include "state_input.hpp"
 #include "state.hpp"
 #include "state_machine.hpp"
+#include "state_machine_graph.hpp"
+#include "state_machine_server.hpp"
 #include "state_transition.hpp"
+#include "transition_timers.hpp"
 
 #include <gdextension_interface.h>
+#include <godot_cpp/classes/engine.hpp>
 #include <godot_cpp/core/defs.hpp>
 #include <godot_cpp/godot.hpp>
 
@@ -18,12 +22,20 @@ void initialize_state(ModuleInitializationLevel p_level) {
 	GDREGISTER_CLASS(godot::ez_fsm::State);
     GDREGISTER_CLASS(godot::ez_fsm::StateInput);
     GDREGISTER_CLASS(godot::ez_fsm::StateTransition);
+    GDREGISTER_CLASS(godot::ez_fsm::StateMachineServer);
+    GDREGISTER_CLASS(godot::ez_fsm::StateMachineGraph);
+
+    godot::Engine::get_singleton()->register_singleton("StateMachineServer", memnew(godot::ez_fsm::StateMachineServer));
 }
 
 void uninitialize_state(ModuleInitializationLevel p_level) {
 	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
 		return;
 	}
+
+    godot::Engine::get_singleton()->unregister_singleton("StateMachineServer");
+    memdelete(godot::ez_fsm::StateMachineServer::get_singleton());
+    godot::ez_fsm::TransitionTimers::reset();
 }
 
 extern "C" {
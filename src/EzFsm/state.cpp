@@ -1,6 +1,7 @@
 #include "state.hpp"
 #include "state_transition.hpp"
 #include "state_machine.hpp"
+#include "state_machine_graph.hpp"
 #include <godot_cpp/classes/engine.hpp>
 #include <godot_cpp/core/class_db.hpp>
 #include <godot_cpp/variant/utility_functions.hpp>
@@ -17,21 +18,45 @@ void State::set_state_name(StringName p_name) {
     if (p_name == state_name) {
         return;
     }
+    ERR_FAIL_COND_MSG(nullptr != machine && machine->graph.is_valid(), "Names are shared by every instance of a graph, rename the graph's state instead of this instance's copy.");
 
-    if (nullptr != machine) {
-        p_name = machine->increment_state_name(p_name);
+    StateMachine *owner = _get_owner();
+    if (nullptr != owner) {
+        p_name = owner->increment_state_name(p_name);
     }
+    StringName old_name = state_name;
     state_name = p_name;
+    if (nullptr != owner) {
+        owner->_state_renamed(this, old_name);
+    }
     emit_changed();
 }
 
+int64_t State::get_state_id() const {
+    return state_id;
+}
+
+void State::set_state_id(int64_t p_id) {
+    ERR_FAIL_COND_MSG(nullptr != machine || nullptr != graph, "State ids are assigned by the state machine and cannot be changed once added.");
+    state_id = p_id;
+}
+
 bool State::is_enabled() const {
-    return enabled;
+    StateMachine *current = nullptr == machine && nullptr != graph ? graph->_get_machine() : nullptr;
+    return nullptr == current ? enabled : current->_is_state_enabled(this);
 }
 
 void State::set_enabled(bool p_enabled) {
+    StateMachine *current = nullptr == machine && nullptr != graph ? graph->_get_machine() : nullptr;
+    if (nullptr != current) {
+        // toggled from one machine's callback, the other machines sharing the state keep their own value
+        current->_override_state_enabled(this, p_enabled);
+        return;
+    }
+
     if (p_enabled != enabled) {
         enabled = p_enabled;
+        _graph_changed();
         emit_changed();
     }
 }
@@ -43,6 +68,31 @@ bool State::can_transition_to_self() const {
 void State::allow_transition_to_self(bool p_allow) {
     if (p_allow != transitions_to_self) {
         transitions_to_self = p_allow;
+        _graph_changed();
+        emit_changed();
+    }
+}
+
+bool State::will_sleep_until_event() const {
+    return sleeps_until_event;
+}
+
+void State::set_sleep_until_event(bool p_sleep) {
+    if (p_sleep != sleeps_until_event) {
+        sleeps_until_event = p_sleep;
+        _graph_changed();
+        emit_changed();
+    }
+}
+
+bool State::is_thread_safe() const {
+    return thread_safe;
+}
+
+void State::set_thread_safe(bool p_thread_safe) {
+    if (p_thread_safe != thread_safe) {
+        thread_safe = p_thread_safe;
+        _graph_changed();
         emit_changed();
     }
 }
@@ -62,14 +112,27 @@ Ref<StateTransition> State::add_transition_to(const Ref<State> &p_to) {
 void State::append_transition(Ref<StateTransition> p_transition) {
     ERR_FAIL_NULL(p_transition);
     ERR_FAIL_COND(transitions.has(p_transition));
-    ERR_FAIL_COND(get_transition_to(p_transition->get_to_state()).is_valid());
-    
+    // by name, a transition that isn't part of a machine yet can't resolve its target
+    ERR_FAIL_COND(_has_transition_to(p_transition->to_state_name));
+
     if (p_transition->get_from_state().is_valid()) {
         p_transition->get_from_state()->remove_transition(p_transition);
     }
+    StateMachine *any_machine = p_transition->_get_any_machine();
+    if (nullptr != any_machine) {
+        any_machine->remove_any_transition(p_transition);
+    }
     p_transition->_set_from_state(this);
     transitions.push_back(p_transition);
-    emit_changed();
+    p_transition->_update_callbacks();
+    _graph_changed();
+
+    StateMachine *owner = _get_owner();
+    if (nullptr != owner && owner->batch_depth > 0) {
+        owner->batch_changed_states.push_back(Ref<State>(this)); // emitted once when the batch ends
+    } else {
+        emit_changed();
+    }
 }
 
 Ref<StateTransition> State::get_transition_to(const Ref<State> &p_to) const {
@@ -82,6 +145,15 @@ Ref<StateTransition> State::get_transition_to(const Ref<State> &p_to) const {
     return Ref<StateTransition>();
 }
 
+bool State::_has_transition_to(const StringName &p_name) const {
+    for (const Ref<StateTransition> &transition : transitions) {
+        if (transition->to_state_name == p_name) {
+            return true;
+        }
+    }
+    return false;
+}
+
 TypedArray<StateTransition> State::get_all_transitions() const {
     TypedArray<StateTransition> out;
     for (const Ref<StateTransition> &transition : transitions) {
@@ -101,6 +173,7 @@ void State::move_transition_priority(Ref<StateTransition> p_transition, uint64_t
     if (idx != p_priority) {
         transitions.remove_at(idx);
         transitions.insert(p_priority, p_transition);
+        _graph_changed();
         emit_changed();
     }
 }
@@ -109,18 +182,21 @@ void State::remove_transition(Ref<StateTransition> p_transition) {
     ERR_FAIL_COND(!transitions.has(p_transition));
     transitions.erase(p_transition);
     p_transition->_set_from_state(nullptr);
+    _graph_changed();
     emit_changed();
 }
 
 bool State::has_sibling(StringName const &p_name) const {
+    StateMachine *machine = get_state_machine();
     if (nullptr == machine) {
         return false;
     } else {
-        return machine->get_all_state_names().has(p_name);
+        return machine->has_state(p_name);
     }
 }
 
 Ref<State> State::get_sibling(StringName const &p_name) const {
+    StateMachine *machine = get_state_machine();
     if (nullptr == machine) {
         return nullptr;
     } else {
@@ -131,6 +207,7 @@ Ref<State> State::get_sibling(StringName const &p_name) const {
 TypedArray<State> State::get_all_siblings() const {
     TypedArray<State> out;
 
+    StateMachine *machine = get_state_machine();
     if (nullptr != machine) {
         TypedArray<State> in = machine->get_all_states();
         out.resize(in.size() - 1);
@@ -149,11 +226,86 @@ void State::_set_state_machine(StateMachine *p_machine) {
     machine = p_machine;
 }
 
+bool State::_has_owner() const {
+    return nullptr != machine || nullptr != graph;
+}
+
+void State::_update_callbacks() {
+    uint8_t active = 0;
+    uint8_t inactive = 0;
+
+    if (GDVIRTUAL_IS_OVERRIDDEN(_active_process)) {
+        active |= CALLBACK_BIT(CALLBACK_PROCESS);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_active_physics_process)) {
+        active |= CALLBACK_BIT(CALLBACK_PHYSICS_PROCESS);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_active_input)) {
+        active |= CALLBACK_BIT(CALLBACK_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_active_shortcut_input)) {
+        active |= CALLBACK_BIT(CALLBACK_SHORTCUT_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_active_unhandled_input)) {
+        active |= CALLBACK_BIT(CALLBACK_UNHANDLED_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_active_unhandled_key_input)) {
+        active |= CALLBACK_BIT(CALLBACK_UNHANDLED_KEY_INPUT);
+    }
+
+    if (GDVIRTUAL_IS_OVERRIDDEN(_inactive_process)) {
+        inactive |= CALLBACK_BIT(CALLBACK_PROCESS);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_inactive_physics_process)) {
+        inactive |= CALLBACK_BIT(CALLBACK_PHYSICS_PROCESS);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_inactive_input)) {
+        inactive |= CALLBACK_BIT(CALLBACK_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_inactive_shortcut_input)) {
+        inactive |= CALLBACK_BIT(CALLBACK_SHORTCUT_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_inactive_unhandled_input)) {
+        inactive |= CALLBACK_BIT(CALLBACK_UNHANDLED_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_inactive_unhandled_key_input)) {
+        inactive |= CALLBACK_BIT(CALLBACK_UNHANDLED_KEY_INPUT);
+    }
+
+    if (active != active_callbacks || inactive != inactive_callbacks) {
+        active_callbacks = active;
+        inactive_callbacks = inactive;
+        _graph_changed();
+    }
+}
+
+void State::_graph_changed() {
+    if (nullptr != machine && machine->graph.is_valid()) {
+        machine->_mark_graph_dirty(); // a per-instance copy, its edits stay with the machine that made it
+    } else if (nullptr != machine) {
+        machine->_graph_changed();
+    } else if (nullptr != graph) {
+        graph->_graph_changed();
+    }
+}
+
 StateMachine *State::get_state_machine() const {
-    return machine;
+    if (nullptr != machine || nullptr == graph) {
+        return machine;
+    }
+
+    // a shared state has no single machine, it answers for whichever one is running it
+    StateMachine *current = graph->_get_machine();
+    ERR_FAIL_NULL_V_MSG(current, nullptr, "State '" + String(state_name) + "' is shared through a StateMachineGraph, its machine is only known inside that machine's callbacks.");
+    return current;
+}
+
+StateMachine *State::_get_owner() const {
+    return nullptr != machine || nullptr == graph ? machine : graph->_get_any_machine();
 }
 
 Node *State::get_context() const {
+    StateMachine *machine = get_state_machine();
     if (nullptr == machine) {
         return nullptr;
     } else {
@@ -162,6 +314,7 @@ Node *State::get_context() const {
 }
 
 void State::set_context(Node *p_context) {
+    StateMachine *machine = get_state_machine();
     if (nullptr == machine) {
         return;
     }
@@ -228,6 +381,10 @@ void State::_bind_methods() {
     ClassDB::bind_method(D_METHOD("get_state_name"), &State::get_state_name);
     ADD_PROPERTY(PropertyInfo(Variant::STRING_NAME, "state_name"), "set_state_name", "get_state_name");
 
+    ClassDB::bind_method(D_METHOD("_set_state_id", "id"), &State::set_state_id);
+    ClassDB::bind_method(D_METHOD("get_state_id"), &State::get_state_id);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "state_id", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_DEFAULT | PROPERTY_USAGE_READ_ONLY), "_set_state_id", "get_state_id");
+
     ClassDB::bind_method(D_METHOD("is_enabled"), &State::is_enabled);
     ClassDB::bind_method(D_METHOD("set_enabled", "enabled"), &State::set_enabled);
     ADD_PROPERTY(PropertyInfo(Variant::BOOL, "enabled"), "set_enabled", "is_enabled");
@@ -236,6 +393,14 @@ void State::_bind_methods() {
     ClassDB::bind_method(D_METHOD("allow_transition_to_self", "allow"), &State::allow_transition_to_self);
     ADD_PROPERTY(PropertyInfo(Variant::BOOL, "transitions_to_self"), "allow_transition_to_self", "can_transition_to_self");
 
+    ClassDB::bind_method(D_METHOD("will_sleep_until_event"), &State::will_sleep_until_event);
+    ClassDB::bind_method(D_METHOD("set_sleep_until_event", "sleep"), &State::set_sleep_until_event);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "sleeps_until_event"), "set_sleep_until_event", "will_sleep_until_event");
+
+    ClassDB::bind_method(D_METHOD("is_thread_safe"), &State::is_thread_safe);
+    ClassDB::bind_method(D_METHOD("set_thread_safe", "thread_safe"), &State::set_thread_safe);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "thread_safe"), "set_thread_safe", "is_thread_safe");
+
     ClassDB::bind_method(D_METHOD("set_context", "context"), &State::set_context);
     ClassDB::bind_method(D_METHOD("get_context"), &State::get_context);
     ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "context", PROPERTY_HINT_NODE_TYPE, "", PROPERTY_USAGE_NONE, "Node"), "set_context", "get_context");
@@ -262,16 +427,35 @@ void State::_bind_methods() {
 }
 
 void State::_get_property_list(List<PropertyInfo> *p_list) const {
-    for (uint64_t idx = 0; idx < transitions.size(); ++idx) {
-        const Ref<StateTransition> &transition = transitions[idx];
-        p_list->push_back(PropertyInfo(
-            Variant::OBJECT, "transitions/" + itos(idx), 
-            PROPERTY_HINT_RESOURCE_TYPE, "StateTransition", PROPERTY_USAGE_DEFAULT | PROPERTY_USAGE_INTERNAL | PROPERTY_USAGE_ALWAYS_DUPLICATE));
-    }
+    // saved as one array, older files list every transition as its own transitions/N property
+    p_list->push_back(PropertyInfo(
+        Variant::ARRAY, "_transitions",
+        PROPERTY_HINT_ARRAY_TYPE, "StateTransition", PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL | PROPERTY_USAGE_ALWAYS_DUPLICATE));
 }
 
 bool State::_set(const StringName &p_name, const Variant &p_value) {
-    if (p_name.begins_with("transitions/")) {
+    if (p_name == StringName("_transitions")) {
+        Array in = p_value;
+        for (const Ref<StateTransition> &transition : transitions) {
+            if (transition.is_valid()) {
+                transition->_set_from_state(nullptr);
+            }
+        }
+        transitions.resize(in.size());
+        Ref<StateTransition> *out = transitions.ptrw();
+        for (int64_t idx = 0; idx < in.size(); ++idx) {
+            out[idx] = in[idx];
+            if (out[idx].is_valid() && out[idx]->_has_owner()) {
+                // duplicate() copies the array but not the transitions in it, they still belong to the original
+                out[idx] = out[idx]->_duplicate_for(this);
+            }
+            if (out[idx].is_valid()) {
+                out[idx]->_set_from_state(this);
+            }
+        }
+        _graph_changed();
+        return true;
+    } else if (p_name.begins_with("transitions/")) {
         Ref<StateTransition> transition = p_value;
         if (transition.is_null()) {
             return false;
@@ -280,8 +464,15 @@ bool State::_set(const StringName &p_name, const Variant &p_value) {
         if (idx >= transitions.size()) {
             transitions.resize(idx + 1);
         }
+        if (transitions[idx].is_valid()) {
+            transitions[idx]->_set_from_state(nullptr);
+        }
+        if (transition->_has_owner()) {
+            transition = transition->_duplicate_for(this);
+        }
         transitions.set(idx, transition);
         transition->_set_from_state(this);
+        _graph_changed();
         return true;
     }
 
@@ -289,7 +480,15 @@ bool State::_set(const StringName &p_name, const Variant &p_value) {
 }
 
 bool State::_get(const StringName &p_name, Variant &r_ret) const {
-    if (p_name.begins_with("transitions/")) {
+    if (p_name == StringName("_transitions")) {
+        TypedArray<StateTransition> out;
+        out.resize(transitions.size());
+        for (int64_t idx = 0; idx < transitions.size(); ++idx) {
+            out[idx] = transitions[idx];
+        }
+        r_ret = out;
+        return true;
+    } else if (p_name.begins_with("transitions/")) {
         uint64_t idx = p_name.get_slicec('/', 1).to_int();
         if (idx >= 0 && idx < transitions.size()) {
             r_ret = transitions[idx];
@@ -302,6 +501,7 @@ bool State::_get(const StringName &p_name, Variant &r_ret) const {
 
 State::State() {
     set_local_to_scene(true);
+    connect("script_changed", callable_mp(this, &State::_update_callbacks));
 }
 
 State::~State() {
@@ -6,28 +6,41 @@
 #include <godot_cpp/classes/resource.hpp>
 #include <godot_cpp/classes/input_event.hpp>
 
+#include "state_callbacks.hpp"
 #include "state_input.hpp"
 
 namespace godot::ez_fsm {
 
 class StateMachine;
+class StateMachineGraph;
 class StateTransition;
 
 class State : public Resource {
     GDCLASS(State, Resource)
 
 friend class StateMachine;
+friend class StateMachineGraph;
+friend class StateTransition;
 
 public:
     StringName get_state_name() const;
     void set_state_name(StringName p_name);
 
+    int64_t get_state_id() const;
+    void set_state_id(int64_t p_id);
+
     bool is_enabled() const;
     void set_enabled(bool p_enabled);
 
     bool can_transition_to_self() const;
     void allow_transition_to_self(bool p_allow);
 
+    bool will_sleep_until_event() const;
+    void set_sleep_until_event(bool p_sleep);
+
+    bool is_thread_safe() const;
+    void set_thread_safe(bool p_thread_safe);
+
     Ref<StateTransition> add_transition_to(const Ref<State> &p_to);
     void append_transition(Ref<StateTransition> p_transition);
     Ref<StateTransition> get_transition_to(const Ref<State> &p_to) const;
@@ -83,13 +96,26 @@ protected:
 
 private:
     StringName state_name;
+    int64_t state_id = -1; // stable handle assigned by the owning machine
     bool enabled { true };
     bool transitions_to_self { false };
+    bool sleeps_until_event { false };
+    bool thread_safe { false };
 
     Vector<Ref<StateTransition>> transitions;
     StateMachine *machine = nullptr;
+    StateMachineGraph *graph = nullptr; // set instead of machine while the state belongs to a shared graph
+
+    // bit masks of StateCallback values whose _active_* or _inactive_* virtual is overridden by the script
+    uint8_t active_callbacks = 0;
+    uint8_t inactive_callbacks = 0;
 
     void _set_state_machine(StateMachine *p_machine);
+    StateMachine *_get_owner() const;
+    bool _has_owner() const;
+    bool _has_transition_to(const StringName &p_name) const;
+    void _update_callbacks();
+    void _graph_changed();
     Ref<StateTransition> _get_transition(uint64_t p_idx) const;
 
 #ifdef DEBUG_ENABLED
@@ -0,0 +1,24 @@
+#ifndef __GDSTATECALLBACKS_H__
+#define __GDSTATECALLBACKS_H__
+
+#include <stdint.h>
+
+namespace godot::ez_fsm {
+
+// Engine callbacks the state machine forwards to its states and transitions.  Each value is a bit index
+// into the override masks that State and StateTransition cache from their attached scripts.
+enum StateCallback : uint8_t {
+    CALLBACK_PROCESS,
+    CALLBACK_PHYSICS_PROCESS,
+    CALLBACK_INPUT,
+    CALLBACK_SHORTCUT_INPUT,
+    CALLBACK_UNHANDLED_INPUT,
+    CALLBACK_UNHANDLED_KEY_INPUT,
+    CALLBACK_MAX,
+};
+
+#define CALLBACK_BIT(p_callback) (uint8_t(1) << (p_callback))
+
+}
+
+#endif
@@ -1,39 +1,297 @@
+#include <godot_cpp/classes/camera2d.hpp>
+#include <godot_cpp/classes/camera3d.hpp>
 #include <godot_cpp/classes/engine.hpp>
+#include <godot_cpp/classes/file_access.hpp>
 #include <godot_cpp/classes/input.hpp>
+#include <godot_cpp/classes/node2d.hpp>
+#include <godot_cpp/classes/node3d.hpp>
+#include <godot_cpp/classes/resource_loader.hpp>
+#include <godot_cpp/classes/script.hpp>
+#include <godot_cpp/classes/stream_peer_buffer.hpp>
+#include <godot_cpp/classes/viewport.hpp>
 #include <godot_cpp/variant/utility_functions.hpp>
 #include "state_machine.hpp"
 #include "state_transition.hpp"
 #include "state_input.hpp"
+#include "transition_timers.hpp"
+#include "state_machine_server.hpp"
 
 using namespace godot;
 using namespace godot::ez_fsm;
 
-// macro that runs the appropriate virtual methods on all states then checks for transitions
-#define EVALUATE_STATES(p_method, ...)                                                                          \
-    Ref<State> active_state = get_active_state();                                                               \
+// how often, in seconds, a machine with a lod_mode picks its tier again
+static constexpr double LOD_REFRESH_INTERVAL = 0.25;
+
+// room left above twice the state count for ids loaded from a file, anything past it is treated as corrupt
+static constexpr int64_t STATE_ID_SLACK = 1024;
+
+// binary format written by export_graph(), bump GRAPH_VERSION whenever the layout changes
+static constexpr uint32_t GRAPH_MAGIC = 0x47465a45; // "EZFG"
+static constexpr uint32_t GRAPH_VERSION = 1;
+// oldest format import_graph() still reads, anything older than it needs a migration there first
+static constexpr uint32_t GRAPH_MIN_VERSION = 1;
+
+enum GraphStateFlags : uint32_t {
+    GRAPH_STATE_ENABLED = 1 << 0,
+    GRAPH_STATE_TRANSITIONS_TO_SELF = 1 << 1,
+    GRAPH_STATE_SLEEPS_UNTIL_EVENT = 1 << 2,
+    GRAPH_STATE_THREAD_SAFE = 1 << 3,
+};
+
+enum GraphTransitionFlags : uint32_t {
+    GRAPH_TRANSITION_THREAD_SAFE = 1 << 0,
+    GRAPH_TRANSITION_INTERVAL_FRAMES = 1 << 1,
+};
+
+struct ImportedTransition {
+    int32_t target = -1;
+    uint32_t flags = 0;
+    String event;
+    double timeout = 0.0;
+    double timeout_jitter = 0.0;
+    double evaluation_interval = 0.0;
+    String signal_source;
+    String signal_name;
+    String script_path;
+    PackedStringArray excluded_states;
+};
+
+struct ImportedState {
+    String name;
+    uint32_t flags = 0;
+    String script_path;
+    LocalVector<ImportedTransition> transitions;
+};
+
+static String _get_script_path(const Object *p_object, const String &p_owner) {
+    Ref<Script> script = p_object->get_script();
+    if (script.is_null()) {
+        return String();
+    }
+
+    String path = script->get_path();
+    ERR_FAIL_COND_V_MSG(path.is_empty() || path.find("::") >= 0, String(),
+        "Built-in or unsaved script on " + p_owner + " can't be exported, save it to a file first.");
+    return path;
+}
+
+static void _apply_script(Object *p_object, const String &p_path) {
+    if (p_path.is_empty()) {
+        return;
+    }
+
+    Ref<Script> script = ResourceLoader::get_singleton()->load(p_path, "Script");
+    ERR_FAIL_COND_MSG(script.is_null(), "Cannot load script '" + p_path + "' from the imported graph.");
+    p_object->set_script(script);
+}
+
+static void _write_transition(StreamPeerBuffer *p_buffer, const StateTransition *p_transition, int32_t p_target, const String &p_owner) {
+    uint32_t flags = 0;
+    if (p_transition->is_thread_safe()) {
+        flags |= GRAPH_TRANSITION_THREAD_SAFE;
+    }
+    if (p_transition->get_evaluation_interval_mode() == StateTransition::INTERVAL_FRAMES) {
+        flags |= GRAPH_TRANSITION_INTERVAL_FRAMES;
+    }
+
+    p_buffer->put_32(p_target);
+    p_buffer->put_u32(flags);
+    p_buffer->put_utf8_string(String(p_transition->get_event()));
+    p_buffer->put_double(p_transition->get_timeout());
+    p_buffer->put_double(p_transition->get_timeout_jitter());
+    p_buffer->put_double(p_transition->get_evaluation_interval());
+    p_buffer->put_utf8_string(String(p_transition->get_signal_source()));
+    p_buffer->put_utf8_string(String(p_transition->get_signal_name()));
+    p_buffer->put_utf8_string(_get_script_path(p_transition, p_owner));
+
+    PackedStringArray excluded = p_transition->get_excluded_states();
+    p_buffer->put_u32(excluded.size());
+    for (int64_t idx = 0; idx < excluded.size(); ++idx) {
+        p_buffer->put_utf8_string(excluded[idx]);
+    }
+}
+
+// every read checks the bytes left first, so truncated or corrupt data fails instead of allocating garbage
+static bool _read_u32(StreamPeerBuffer *p_buffer, uint32_t &r_value) {
+    if (p_buffer->get_available_bytes() < 4) {
+        return false;
+    }
+    r_value = p_buffer->get_u32();
+    return true;
+}
+
+static bool _read_string(StreamPeerBuffer *p_buffer, String &r_string) {
+    uint32_t length = 0;
+    if (!_read_u32(p_buffer, length) || length > uint32_t(p_buffer->get_available_bytes())) {
+        return false;
+    }
+    r_string = length == 0 ? String() : p_buffer->get_utf8_string(length);
+    return true;
+}
+
+static bool _read_transition(StreamPeerBuffer *p_buffer, ImportedTransition &r_transition) {
+    if (p_buffer->get_available_bytes() < 8) {
+        return false;
+    }
+    r_transition.target = p_buffer->get_32();
+    r_transition.flags = p_buffer->get_u32();
+    if (!_read_string(p_buffer, r_transition.event) || p_buffer->get_available_bytes() < 24) {
+        return false;
+    }
+    r_transition.timeout = p_buffer->get_double();
+    r_transition.timeout_jitter = p_buffer->get_double();
+    r_transition.evaluation_interval = p_buffer->get_double();
+
+    uint32_t excluded_count = 0;
+    if (!_read_string(p_buffer, r_transition.signal_source) || !_read_string(p_buffer, r_transition.signal_name) ||
+            !_read_string(p_buffer, r_transition.script_path) || !_read_u32(p_buffer, excluded_count) ||
+            excluded_count > uint32_t(p_buffer->get_available_bytes()) / 4) {
+        return false;
+    }
+    for (uint32_t idx = 0; idx < excluded_count; ++idx) {
+        String name;
+        if (!_read_string(p_buffer, name)) {
+            return false;
+        }
+        r_transition.excluded_states.push_back(name);
+    }
+    return true;
+}
+
+static void _apply_transition(StateTransition *p_transition, const ImportedTransition &p_imported) {
+    p_transition->set_event(p_imported.event);
+    p_transition->set_timeout(p_imported.timeout);
+    p_transition->set_timeout_jitter(p_imported.timeout_jitter);
+    p_transition->set_evaluation_interval(p_imported.evaluation_interval);
+    p_transition->set_evaluation_interval_mode(
+        (p_imported.flags & GRAPH_TRANSITION_INTERVAL_FRAMES) ? StateTransition::INTERVAL_FRAMES : StateTransition::INTERVAL_SECONDS);
+    p_transition->set_thread_safe(p_imported.flags & GRAPH_TRANSITION_THREAD_SAFE);
+    p_transition->set_signal_source(NodePath(p_imported.signal_source));
+    p_transition->set_signal_name(p_imported.signal_name);
+    p_transition->set_excluded_states(p_imported.excluded_states);
+    _apply_script(p_transition, p_imported.script_path);
+}
+
+thread_local StateMachine *StateMachine::current_machine = nullptr;
+
+// macro that runs the overridden virtual methods on subscribed states then checks for transitions
+// scripts can mutate the graph from any callback; the loops then rebake and resume where they were, after the state
+// just called or at the transition that just ran, so one edit doesn't cost the rest of the tick.
+// p_arg is handed to the states' virtuals and p_transition_arg to the transitions'.  Entries limited by an
+// evaluation_interval are skipped until it elapses; transition_delta then holds the time since they last ran.
+#define EVALUATE_STATES(p_callback, p_method, p_arg, p_delta, p_transition_arg)                                 \
+    CurrentMachineScope machine_scope(this);                                                                    \
+    _bake();                                                                                                    \
+    uint32_t version = bake_version;                                                                            \
+    int64_t active_slot = running ? int64_t(active_state_idx) : -1;                                             \
+    bool evaluating = true;                                                                                     \
                                                                                                                 \
-    for (const Ref<State> &state : states) {                                                                    \
-        if (!state->is_enabled()) {                                                                             \
-            continue;                                                                                           \
+    const LocalVector<uint32_t> &subscribed_states = baked_callback_states[p_callback];                         \
+    for (uint32_t idx = 0; idx < subscribed_states.size();) {                                                   \
+        uint32_t slot = subscribed_states[idx++];                                                               \
+        if (slot == active_slot) {                                                                              \
+            if (baked_active_callbacks[slot] & CALLBACK_BIT(p_callback)) {                                      \
+                GDVIRTUAL_CALL_PTR(states[slot].ptr(), _active##p_method, p_arg);                               \
+            }                                                                                                   \
+        } else if (baked_inactive_callbacks[slot] & CALLBACK_BIT(p_callback)) {                                 \
+            GDVIRTUAL_CALL_PTR(states[slot].ptr(), _inactive##p_method, p_arg);                                 \
         }                                                                                                       \
-                                                                                                                \
-        if (state == active_state) {                                                                            \
-            GDVIRTUAL_CALL_PTR(state, _active##p_method, __VA_ARGS__);                                          \
-        } else {                                                                                                \
-            GDVIRTUAL_CALL_PTR(state, _inactive##p_method, __VA_ARGS__);                                        \
+        if (!_is_bake_current(version)) {                                                                       \
+            evaluating = _resume_bake(version);                                                                 \
+            if (!evaluating) {                                                                                  \
+                break;                                                                                          \
+            }                                                                                                   \
+            active_slot = active_state_idx;                                                                     \
+            idx = _next_subscribed_state(p_callback, slot);                                                     \
         }                                                                                                       \
     }                                                                                                           \
                                                                                                                 \
-    if (active_state.is_valid()) {                                                                              \
-        for (Ref<StateTransition> transition : active_state->transitions) {                                     \
+    if (evaluating && active_slot >= 0) {                                                                       \
+        uint32_t chain_stamp = ++chain_stamp_counter;                                                           \
+        int64_t transitions_left = max_transitions_per_tick;                                                    \
+        double chain_delta = p_delta;                                                                           \
+        bool chain = true;                                                                                      \
+        baked_chain_stamps[active_slot] = chain_stamp;                                                          \
+        /* any-state transitions run once, ahead of the active state's own */                                   \
+        int64_t any_first = baked_any_callback_offsets[p_callback];                                             \
+        int64_t any_end = baked_any_callback_offsets[p_callback + 1];                                           \
+        for (int64_t idx = any_first; idx < any_end; ++idx) {                                                   \
+            if (_is_any_excluded(baked_callback_transitions[idx], active_slot)) {                               \
+                continue;                                                                                       \
+            }                                                                                                   \
+            double transition_delta = chain_delta;                                                              \
+            bool ready = baked_callback_intervals[idx] <= 0.0;                                                  \
+            if (!ready && !_advance_interval(idx, chain_delta, transition_delta)) {                             \
+                continue;                                                                                       \
+            }                                                                                                   \
+            StateTransition *current = baked_transitions[baked_callback_transitions[idx]];                      \
             bool do_transition = false;                                                                         \
-            GDVIRTUAL_CALL_PTR(transition, p_method, __VA_ARGS__, do_transition);                               \
-            if (do_transition) {                                                                                \
-                bool success = transition_to(transition->to_state_name, transition->input);                     \
-                if (success) {                                                                                  \
+            GDVIRTUAL_CALL_PTR(current, p_method, p_transition_arg, do_transition);                             \
+            if (!_is_bake_current(version)) {                                                                   \
+                if (!_resume_bake(version)) {                                                                   \
+                    chain = false;                                                                              \
+                    break;                                                                                      \
+                }                                                                                               \
+                active_slot = active_state_idx;                                                                 \
+                bool kept = _resume_callback_loop(-1, p_callback, current, idx - any_first,                     \
+                    any_end - any_first, any_first, idx, any_end);                                              \
+                do_transition = do_transition && kept;                                                          \
+            }                                                                                                   \
+            if (do_transition && _trigger_baked_transition(baked_callback_transitions[idx])) {                  \
+                chain = --transitions_left > 0 && !deferring_transitions && running;                            \
+                if (chain && !_is_bake_current(version)) {                                                      \
+                    chain = _resume_bake(version);                                                              \
+                }                                                                                               \
+                if (chain) {                                                                                    \
+                    active_slot = active_state_idx;                                                             \
+                    chain = baked_chain_stamps[active_slot] != chain_stamp;                                     \
+                }                                                                                               \
+                chain_delta = 0.0;                                                                              \
+                break;                                                                                          \
+            }                                                                                                   \
+        }                                                                                                       \
+        while (chain) {                                                                                         \
+            baked_chain_stamps[active_slot] = chain_stamp;                                                      \
+            bool fired = false;                                                                                 \
+            uint32_t range = active_slot * CALLBACK_MAX + p_callback;                                           \
+            int64_t first = baked_callback_offsets[range];                                                      \
+            int64_t end = baked_callback_offsets[range + 1];                                                    \
+            for (int64_t idx = first; idx < end; ++idx) {                                                       \
+                double transition_delta = chain_delta;                                                          \
+                bool ready = baked_callback_intervals[idx] <= 0.0;                                              \
+                if (!ready && !_advance_interval(idx, chain_delta, transition_delta)) {                         \
+                    continue;                                                                                   \
+                }                                                                                               \
+                StateTransition *current = baked_transitions[baked_callback_transitions[idx]];                  \
+                bool do_transition = false;                                                                     \
+                GDVIRTUAL_CALL_PTR(current, p_method, p_transition_arg, do_transition);                         \
+                if (!_is_bake_current(version)) {                                                               \
+                    if (!_resume_bake(version)) {                                                               \
+                        chain = false;                                                                          \
+                        break;                                                                                  \
+                    }                                                                                           \
+                    active_slot = active_state_idx;                                                             \
+                    bool kept = _resume_callback_loop(active_slot, p_callback, current, idx - first,            \
+                        end - first, first, idx, end);                                                          \
+                    do_transition = do_transition && kept;                                                      \
+                }                                                                                               \
+                if (do_transition && _trigger_baked_transition(baked_callback_transitions[idx])) {              \
+                    fired = true;                                                                               \
                     break;                                                                                      \
                 }                                                                                               \
             }                                                                                                   \
+            /* chain into the new state's transitions, stopping at a state already visited this tick */         \
+            if (!chain || !fired || --transitions_left <= 0 || deferring_transitions || !running) {             \
+                break;                                                                                          \
+            }                                                                                                   \
+            if (!_is_bake_current(version) && !_resume_bake(version)) {                                         \
+                break;                                                                                          \
+            }                                                                                                   \
+            active_slot = active_state_idx;                                                                     \
+            if (baked_chain_stamps[active_slot] == chain_stamp) {                                               \
+                break;                                                                                          \
+            }                                                                                                   \
+            chain_delta = 0.0;                                                                                  \
         }                                                                                                       \
     }
 
@@ -47,30 +305,261 @@ TypedArray<StringName> StateMachine::get_all_state_names() const {
 
 TypedArray<State> StateMachine::get_all_states() const {
     TypedArray<State> out;
-    for (const Ref<State> &state : states) {
-        out.push_back(state);
+    for (uint32_t slot = 0; slot < states.size(); ++slot) {
+        _materialize_state(slot);
+        out.push_back(states[slot]);
     }
     return out;
 }
 
 bool StateMachine::has_state(const StringName &p_state) const {
+    return state_index.has(p_state);
+}
+
+Ref<State> StateMachine::get_state(const StringName &p_state) const {
+    const uint32_t *slot = state_index.getptr(p_state);
+    if (nullptr == slot) {
+        return Ref<State>();
+    }
+
+    _materialize_state(*slot);
+    return states[*slot];
+}
+
+int64_t StateMachine::get_state_id(const StringName &p_state) const {
+    const uint32_t *slot = state_index.getptr(p_state);
+    if (nullptr == slot) {
+        return -1;
+    }
+
+    return states[*slot]->get_state_id();
+}
+
+Ref<State> StateMachine::get_state_by_id(int64_t p_id) const {
+    int64_t slot = _get_slot_by_id(p_id);
+    if (slot < 0) {
+        return Ref<State>();
+    }
+
+    _materialize_state(slot);
+    return states[slot];
+}
+
+Dictionary StateMachine::get_state_ids() const {
+    Dictionary out;
     for (const Ref<State> &state : states) {
-        if (state->get_state_name() == p_state) {
-            return true;
+        out[state->get_state_name()] = state->get_state_id();
+    }
+    return out;
+}
+
+Error StateMachine::save_state_constants(const String &p_path) const {
+    // names like "Run" and "run" map to the same constant, which GDScript would refuse to parse
+    PackedStringArray lines;
+    HashMap<String, StringName> constants;
+    for (const Ref<State> &state : states) {
+        String constant = String(state->get_state_name()).to_snake_case().to_upper();
+        for (int64_t idx = 0; idx < constant.length(); ++idx) {
+            if (!is_ascii_identifier_char(constant[idx])) {
+                constant[idx] = '_';
+            }
+        }
+        if (constant.is_empty() || is_digit(constant[0])) {
+            constant = "_" + constant;
         }
+        const StringName *other = constants.getptr(constant);
+        ERR_FAIL_COND_V_MSG(nullptr != other, ERR_ALREADY_EXISTS,
+            "States '" + String(*other) + "' and '" + String(state->get_state_name()) + "' would both be saved as the constant " + constant + ", rename one of them.");
+        constants.insert(constant, state->get_state_name());
+        lines.push_back("const " + constant + " := " + itos(state->get_state_id()));
     }
 
-    return false;
+    Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::WRITE);
+    ERR_FAIL_NULL_V_MSG(file, FileAccess::get_open_error(), "Cannot open file '" + p_path + "' for writing.");
+
+    file->store_line("# Generated by EzFSM from " + String(get_name()) + ", regenerate it after adding or removing states.");
+    for (int64_t idx = 0; idx < lines.size(); ++idx) {
+        file->store_line(lines[idx]);
+    }
+
+    return OK;
 }
 
-Ref<State> StateMachine::get_state(const StringName &p_state) const {
+PackedByteArray StateMachine::export_graph() const {
+    Ref<StreamPeerBuffer> buffer;
+    buffer.instantiate();
+
+    // empty slots are skipped like _bake() does, so every written slot is renumbered to leave no gaps
+    LocalVector<int32_t> exported_slots;
+    exported_slots.resize(states.size());
+    uint32_t exported_count = 0;
+    for (uint32_t slot = 0; slot < states.size(); ++slot) {
+        exported_slots[slot] = states[slot].is_null() ? -1 : int32_t(exported_count++);
+    }
+    auto exported_slot = [&](int64_t p_slot) -> int32_t {
+        return p_slot < 0 ? -1 : exported_slots[p_slot];
+    };
+
+    buffer->put_u32(GRAPH_MAGIC);
+    buffer->put_u32(GRAPH_VERSION);
+    buffer->put_u32(exported_count);
+    buffer->put_32(exported_slot(_get_slot(default_state_name)));
+
     for (const Ref<State> &state : states) {
-        if (state->get_state_name() == p_state) {
-            return state;
+        if (state.is_null()) {
+            continue;
+        }
+
+        uint32_t flags = 0;
+        if (_is_state_enabled(state.ptr())) {
+            flags |= GRAPH_STATE_ENABLED;
+        }
+        if (state->can_transition_to_self()) {
+            flags |= GRAPH_STATE_TRANSITIONS_TO_SELF;
+        }
+        if (state->will_sleep_until_event()) {
+            flags |= GRAPH_STATE_SLEEPS_UNTIL_EVENT;
         }
+        if (state->is_thread_safe()) {
+            flags |= GRAPH_STATE_THREAD_SAFE;
+        }
+
+        buffer->put_utf8_string(String(state->get_state_name()));
+        buffer->put_u32(flags);
+        buffer->put_utf8_string(_get_script_path(state.ptr(), "state '" + String(state->get_state_name()) + "'"));
+        // written in priority order, which import_graph() restores
+        uint32_t transition_count = 0;
+        for (const Ref<StateTransition> &transition : state->transitions) {
+            transition_count += transition.is_valid();
+        }
+        buffer->put_u32(transition_count);
+        for (const Ref<StateTransition> &transition : state->transitions) {
+            if (transition.is_null()) {
+                continue;
+            }
+            _write_transition(buffer.ptr(), transition.ptr(), exported_slot(_get_target_slot(transition.ptr())),
+                "transition '" + String(state->state_name) + "' -> '" + String(transition->to_state_name) + "'");
+        }
+    }
+
+    TypedArray<StateTransition> any = get_any_transitions();
+    buffer->put_u32(any.size());
+    for (int64_t idx = 0; idx < any.size(); ++idx) {
+        const StateTransition *transition = Object::cast_to<StateTransition>(any[idx]);
+        _write_transition(buffer.ptr(), transition, exported_slot(_get_target_slot(transition)), "any-state transition to '" + String(transition->to_state_name) + "'");
+    }
+
+    return buffer->get_data_array();
+}
+
+Error StateMachine::import_graph(const PackedByteArray &p_data) {
+    ERR_FAIL_COND_V_MSG(running, ERR_BUSY, "Stop the state machine before importing a graph.");
+    ERR_FAIL_COND_V_MSG(graph.is_valid(), ERR_UNAVAILABLE, "Importing would rewrite the graph shared with every other machine, clear graph first.");
+
+    Ref<StreamPeerBuffer> buffer;
+    buffer.instantiate();
+    buffer->set_data_array(p_data);
+
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    ERR_FAIL_COND_V_MSG(!_read_u32(buffer.ptr(), magic) || magic != GRAPH_MAGIC, ERR_FILE_UNRECOGNIZED, "Data is not an exported state machine graph.");
+    ERR_FAIL_COND_V_MSG(!_read_u32(buffer.ptr(), version) || version < GRAPH_MIN_VERSION || version > GRAPH_VERSION, ERR_FILE_UNRECOGNIZED,
+        "Graph was exported in format version " + itos(version) + ", this version of EzFSM reads versions " + itos(GRAPH_MIN_VERSION) + " to " + itos(GRAPH_VERSION) + ".");
+
+    // everything is parsed before the machine is touched, so bad data leaves it as it was
+    uint32_t state_count = 0;
+    ERR_FAIL_COND_V_MSG(!_read_u32(buffer.ptr(), state_count) || state_count > uint32_t(buffer->get_available_bytes()) / 4,
+        ERR_FILE_CORRUPT, "Graph data is truncated or corrupt.");
+    ERR_FAIL_COND_V_MSG(buffer->get_available_bytes() < 4, ERR_FILE_CORRUPT, "Graph data is truncated or corrupt.");
+    int32_t default_slot = buffer->get_32();
+
+    LocalVector<ImportedState> imported;
+    imported.resize(state_count);
+    for (ImportedState &state : imported) {
+        uint32_t transition_count = 0;
+        bool valid = _read_string(buffer.ptr(), state.name) && _read_u32(buffer.ptr(), state.flags) &&
+            _read_string(buffer.ptr(), state.script_path) && _read_u32(buffer.ptr(), transition_count) &&
+            transition_count <= uint32_t(buffer->get_available_bytes()) / 4;
+        ERR_FAIL_COND_V_MSG(!valid, ERR_FILE_CORRUPT, "Graph data is truncated or corrupt.");
+
+        state.transitions.resize(transition_count);
+        for (ImportedTransition &transition : state.transitions) {
+            ERR_FAIL_COND_V_MSG(!_read_transition(buffer.ptr(), transition), ERR_FILE_CORRUPT, "Graph data is truncated or corrupt.");
+        }
+    }
+
+    uint32_t any_count = 0;
+    ERR_FAIL_COND_V_MSG(!_read_u32(buffer.ptr(), any_count) || any_count > uint32_t(buffer->get_available_bytes()) / 4,
+        ERR_FILE_CORRUPT, "Graph data is truncated or corrupt.");
+    LocalVector<ImportedTransition> imported_any;
+    imported_any.resize(any_count);
+    for (ImportedTransition &transition : imported_any) {
+        ERR_FAIL_COND_V_MSG(!_read_transition(buffer.ptr(), transition), ERR_FILE_CORRUPT, "Graph data is truncated or corrupt.");
+    }
+
+    // rebuild through the bulk path, the whole import costs one consolidated update
+    begin_batch();
+    while (!any_transitions.is_empty()) {
+        remove_any_transition(any_transitions[any_transitions.size() - 1]);
     }
+    while (!states.is_empty()) {
+        remove_state(states[states.size() - 1]); // from the back, so no slots need reindexing
+    }
+
+    PackedStringArray names;
+    names.resize(state_count);
+    for (uint32_t slot = 0; slot < state_count; ++slot) {
+        names[slot] = imported[slot].name;
+    }
+    TypedArray<State> added = add_states(names);
+
+    PackedInt32Array edges;
+    for (uint32_t slot = 0; slot < state_count; ++slot) {
+        State *state = Object::cast_to<State>(added[slot]);
+        const ImportedState &source = imported[slot];
+        state->set_enabled(source.flags & GRAPH_STATE_ENABLED);
+        state->allow_transition_to_self(source.flags & GRAPH_STATE_TRANSITIONS_TO_SELF);
+        state->set_sleep_until_event(source.flags & GRAPH_STATE_SLEEPS_UNTIL_EVENT);
+        state->set_thread_safe(source.flags & GRAPH_STATE_THREAD_SAFE);
+        _apply_script(state, source.script_path);
+
+        for (const ImportedTransition &transition : source.transitions) {
+            ERR_CONTINUE_MSG(transition.target < 0 || uint32_t(transition.target) >= state_count,
+                "Imported transition from '" + source.name + "' has no valid target, skipping it.");
+            edges.push_back(slot);
+            edges.push_back(transition.target);
+        }
+    }
+    add_transitions(edges);
+
+    // add_transitions() skips invalid and repeated edges, so match each record to its transition by target
+    for (uint32_t slot = 0; slot < state_count; ++slot) {
+        State *state = Object::cast_to<State>(added[slot]);
+        uint32_t next = 0;
+        for (const ImportedTransition &transition : imported[slot].transitions) {
+            if (next >= uint32_t(state->transitions.size()) || transition.target < 0 || uint32_t(transition.target) >= state_count) {
+                continue;
+            }
+            const State *target = Object::cast_to<State>(added[transition.target]);
+            if (state->transitions[next]->to_state_name == target->get_state_name()) {
+                _apply_transition(state->transitions[next].ptr(), transition);
+                ++next;
+            }
+        }
+    }
+
+    for (const ImportedTransition &transition : imported_any) {
+        ERR_CONTINUE_MSG(transition.target < 0 || uint32_t(transition.target) >= state_count, "Imported any-state transition has no valid target, skipping it.");
+        Ref<StateTransition> any = add_any_transition(added[transition.target]);
+        _apply_transition(any.ptr(), transition);
+    }
+
+    if (default_slot >= 0 && uint32_t(default_slot) < state_count) {
+        set_default_state(added[default_slot]);
+    }
+    end_batch();
 
-    return Ref<State>();
+    return OK;
 }
 
 StringName StateMachine::increment_state_name(const StringName &p_name) const {
@@ -109,6 +598,11 @@ void StateMachine::set_default_state(const Ref<State> &p_state) {
         } else {
             default_state_name = StringName();
         }
+        if (graph.is_valid() && batch_depth > 0) {
+            batch_graph_changed = true; // published with the rest of the batch by end_batch()
+        } else if (graph.is_valid()) {
+            graph->_publish(this);
+        }
         update_configuration_warnings();
         emit_signal("default_changed", get_default_state());
     }
@@ -122,6 +616,10 @@ Ref<State> StateMachine::get_active_state() const {
     }
 }
 
+int64_t StateMachine::get_active_state_id() const {
+    return active_state_id.load(std::memory_order_acquire);
+}
+
 Ref<State> StateMachine::add_state(const StringName &p_name) {
     Ref<State> state;
     state.instantiate();
@@ -133,26 +631,51 @@ Ref<State> StateMachine::add_state(const StringName &p_name) {
 
 void StateMachine::append_state(const Ref<State> &p_state) {
     ERR_FAIL_NULL(p_state);
-    ERR_FAIL_COND_MSG(states.has(p_state), "State already added to state machine.");
+    ERR_FAIL_COND_MSG(_owns_state(p_state.ptr()), "State already added to state machine.");
 
+    StateMachine *owner = p_state->_get_owner();
+    if (nullptr != owner) {
+        owner->remove_state(p_state);
+    }
     bool is_default = states.is_empty();
-    states.append(p_state);
     p_state->set_state_name(increment_state_name(p_state->get_state_name()));
-    if (nullptr != p_state->get_state_machine()) {
-        p_state->get_state_machine()->remove_state(p_state);
-    }
-    p_state->_set_state_machine(this);
+    state_index.insert(p_state->get_state_name(), states.size());
+    _assign_state_id(p_state.ptr(), states.size());
+    states.append(p_state);
+    _claim_state(p_state.ptr(), true);
+    _graph_changed();
     if (is_default) {
         set_default_state(p_state);
     }
+    if (batch_depth > 0) {
+        batch_added_states.push_back(p_state);
+        return;
+    }
     update_configuration_warnings();
     notify_property_list_changed();
     emit_signal("state_added", p_state);
 }
 
+TypedArray<State> StateMachine::add_states(const PackedStringArray &p_names) {
+    TypedArray<State> out;
+    out.resize(p_names.size());
+
+    begin_batch();
+    for (int64_t idx = 0; idx < p_names.size(); ++idx) {
+        Ref<State> state;
+        state.instantiate();
+        state->set_state_name(p_names[idx]);
+        append_state(state);
+        out[idx] = state;
+    }
+    end_batch();
+
+    return out;
+}
+
 
 void StateMachine::remove_state(Ref<State> p_state) {
-    if (p_state.is_valid() && states.has(p_state)) {
+    if (p_state.is_valid() && _owns_state(p_state.ptr())) {
         if (p_state == get_active_state()) {
             stop();
         }
@@ -163,8 +686,30 @@ void StateMachine::remove_state(Ref<State> p_state) {
                 set_default_state(Ref<State>());
             }
         }
-        states.erase(p_state);
-        p_state->_set_state_machine(nullptr);
+        int64_t slot = _get_slot(p_state->get_state_name());
+        ERR_FAIL_COND(slot < 0 || states[slot] != p_state);
+        state_index.erase(p_state->get_state_name());
+        id_slots[p_state->get_state_id()] = -1;
+        states.remove_at(slot);
+        _reindex_states(slot);
+        if (running && active_state_idx > uint64_t(slot)) {
+            --active_state_idx;
+        }
+        State *state_template = _get_template(p_state.ptr());
+        if (nullptr != state_template) {
+            // removing this machine's copy removes the state from the graph, the template goes with it
+            state_copies.erase(state_template);
+            state_template->graph = nullptr;
+            p_state->_set_state_machine(nullptr);
+        } else {
+            enabled_overrides.erase(p_state.ptr());
+            _claim_state(p_state.ptr(), false);
+        }
+        _graph_changed();
+        if (batch_depth > 0) {
+            batch_removed_states.push_back(p_state);
+            return;
+        }
         update_configuration_warnings();
         notify_property_list_changed();
         emit_signal("state_removed", p_state);
@@ -190,231 +735,1803 @@ void StateMachine::remove_transition(Ref<StateTransition> p_transition) {
     }
 }
 
-TypedArray<StateTransition> StateMachine::get_transitions_from(const Ref<State> &p_from) const {
-    ERR_FAIL_NULL_V(p_from, TypedArray<StateTransition>());
-
-    return p_from->get_all_transitions();
+TypedArray<StateTransition> StateMachine::add_transitions(const PackedInt32Array &p_edges) {
+    ERR_FAIL_COND_V_MSG(p_edges.size() % 2 != 0, TypedArray<StateTransition>(), "Edges must be given as pairs of from and to state indices.");
+
+    TypedArray<StateTransition> out;
+    // states of a shared graph look their machine up through the current one, so every append lands in this batch
+    CurrentMachineScope scope(this);
+    begin_batch();
+    const int32_t *edges = p_edges.ptr();
+    for (int64_t idx = 0; idx < p_edges.size(); idx += 2) {
+        int32_t from = edges[idx];
+        int32_t to = edges[idx + 1];
+        ERR_CONTINUE_MSG(from < 0 || from >= states.size() || to < 0 || to >= states.size(), "Edge " + itos(idx / 2) + " refers to a state index out of range.");
+        const Ref<State> &from_state = states[from];
+        const Ref<State> &to_state = states[to];
+        ERR_CONTINUE(from_state.is_null() || to_state.is_null());
+        if (from_state->_has_transition_to(to_state->state_name)) {
+            continue;
+        }
+        ERR_CONTINUE_MSG(from == to && !from_state->can_transition_to_self(), "Edge " + itos(idx / 2) + " links state '" + String(from_state->state_name) + "' to itself, which it doesn't allow.");
+
+        Ref<StateTransition> transition;
+        transition.instantiate();
+        transition->set_to_state(to_state);
+        from_state->append_transition(transition);
+        out.push_back(transition);
+    }
+    end_batch();
+
+    return out;
+}
+
+void StateMachine::begin_batch() {
+    ++batch_depth;
+}
+
+void StateMachine::end_batch() {
+    ERR_FAIL_COND_MSG(batch_depth <= 0, "end_batch() called without a matching begin_batch().");
+    if (--batch_depth > 0) {
+        return;
+    }
+
+    // the lists are swapped out first, since the signals below may start another batch
+    LocalVector<Ref<State>> added;
+    LocalVector<Ref<State>> removed;
+    LocalVector<Ref<State>> changed;
+    SWAP(added, batch_added_states);
+    SWAP(removed, batch_removed_states);
+    SWAP(changed, batch_changed_states);
+
+    if (batch_graph_changed) {
+        batch_graph_changed = false;
+        _graph_changed();
+    }
+    if (!added.is_empty() || !removed.is_empty()) {
+        update_configuration_warnings();
+        notify_property_list_changed();
+    }
+    HashSet<State *> emitted;
+    for (const Ref<State> &state : changed) {
+        if (!emitted.has(state.ptr())) {
+            emitted.insert(state.ptr());
+            state->emit_changed();
+        }
+    }
+    for (const Ref<State> &state : removed) {
+        emit_signal("state_removed", state);
+    }
+    for (const Ref<State> &state : added) {
+        emit_signal("state_added", state);
+    }
+}
+
+bool StateMachine::is_batching() const {
+    return batch_depth > 0;
+}
+
+Ref<StateTransition> StateMachine::add_any_transition(const Ref<State> &p_to) {
+    ERR_FAIL_NULL_V(p_to, nullptr);
+
+    Ref<StateTransition> transition;
+    transition.instantiate();
+    transition->set_to_state(p_to);
+    append_any_transition(transition);
+    return transition;
+}
+
+void StateMachine::append_any_transition(const Ref<StateTransition> &p_transition) {
+    ERR_FAIL_NULL(p_transition);
+    ERR_FAIL_COND_MSG(p_transition->get_from_state().is_valid(), "Transition belongs to a state, remove it from the state first.");
+    ERR_FAIL_COND(any_transitions.has(p_transition));
+
+    StateMachine *owner = p_transition->_get_any_machine();
+    if (nullptr != owner) {
+        owner->remove_any_transition(p_transition);
+    }
+    _claim_any_transition(p_transition.ptr(), true);
+    any_transitions.push_back(p_transition);
+    _graph_changed();
+    p_transition->emit_changed();
+}
+
+void StateMachine::remove_any_transition(const Ref<StateTransition> &p_transition) {
+    ERR_FAIL_NULL(p_transition);
+    ERR_FAIL_COND(!any_transitions.has(p_transition));
+
+    any_transitions.erase(p_transition);
+    _claim_any_transition(p_transition.ptr(), false);
+    _graph_changed();
+    p_transition->emit_changed();
+}
+
+TypedArray<StateTransition> StateMachine::get_any_transitions() const {
+    TypedArray<StateTransition> out;
+    for (const Ref<StateTransition> &transition : any_transitions) {
+        if (transition.is_valid()) {
+            out.push_back(transition);
+        }
+    }
+    return out;
+}
+
+TypedArray<StateTransition> StateMachine::get_transitions_from(const Ref<State> &p_from) const {
+    ERR_FAIL_NULL_V(p_from, TypedArray<StateTransition>());
+
+    return p_from->get_all_transitions();
+}
+
+TypedArray<StateTransition> StateMachine::get_transitions_to(const Ref<State> &p_to) const {
+    ERR_FAIL_NULL_V(p_to, TypedArray<StateTransition>());
+
+    TypedArray<StateTransition> out;
+    for (const Ref<State> &state : states) {
+        Ref<StateTransition> transition = state->get_transition_to(p_to);
+        if (transition.is_valid()) {
+            out.push_back(transition);
+        }
+    }
+
+    return out;
+}
+
+Ref<StateTransition> StateMachine::get_transition_between(const Ref<State> &p_from, const Ref<State> &p_to) const {
+    ERR_FAIL_NULL_V(p_from, nullptr);
+    ERR_FAIL_NULL_V(p_to, nullptr);
+
+    return p_from->get_transition_to(p_to);
+}
+
+TypedArray<StateTransition> StateMachine::get_all_transitions() const {
+    TypedArray<StateTransition> out;
+    for (const Ref<State> &state : states) {
+        out.append_array(state->get_all_transitions());
+    }
+    return out;
+}
+
+void StateMachine::set_graph(const Ref<StateMachineGraph> &p_graph) {
+    if (p_graph == graph) {
+        return;
+    }
+    ERR_FAIL_COND_MSG(running, "Stop the state machine before changing its graph.");
+
+    Vector<Ref<State>> kept_states;
+    Vector<Ref<StateTransition>> kept_any_transitions;
+    StringName kept_default_state_name;
+    if (graph.is_valid() && p_graph.is_null()) {
+        // leaving a graph keeps its topology, as states this machine owns; copies it already made are reused
+        graph->_detach(this);
+        for (const Ref<State> &state : states) {
+            kept_states.push_back(state.is_valid() && state->machine != this ? _duplicate_state(state) : state);
+        }
+        for (const Ref<StateTransition> &transition : any_transitions) {
+            if (transition.is_valid()) {
+                kept_any_transitions.push_back(transition->_duplicate_for(nullptr));
+            }
+        }
+        kept_default_state_name = default_state_name;
+        state_copies.clear();
+    } else if (graph.is_valid()) {
+        graph->_detach(this);
+        _drop_state_copies();
+    } else if (p_graph.is_valid() && p_graph->states.is_empty()) {
+        // an empty graph takes over the states this machine already has, which is how a graph is authored
+        for (const Ref<State> &state : states) {
+            _claim_state(state.ptr(), false);
+            state->graph = p_graph.ptr();
+        }
+        for (const Ref<StateTransition> &transition : any_transitions) {
+            if (transition.is_valid()) {
+                _claim_any_transition(transition.ptr(), false);
+                transition->any_graph = p_graph.ptr();
+            }
+        }
+        p_graph->states = states;
+        p_graph->any_transitions = any_transitions;
+        p_graph->default_state_name = default_state_name;
+    } else {
+        if (!states.is_empty()) {
+            WARN_PRINT("Assigning a graph that already has states to '" + String(get_name()) + "' discards its own " + itos(states.size()) + " state(s).");
+        }
+        for (const Ref<State> &state : states) {
+            _claim_state(state.ptr(), false);
+        }
+        for (const Ref<StateTransition> &transition : any_transitions) {
+            if (transition.is_valid()) {
+                _claim_any_transition(transition.ptr(), false);
+            }
+        }
+    }
+    states.clear();
+    any_transitions.clear();
+    state_index.clear();
+    id_slots.clear();
+    enabled_overrides.clear();
+    default_state_name = StringName();
+
+    graph = p_graph;
+    if (graph.is_valid()) {
+        graph->_attach(this);
+        _pull_graph();
+    } else {
+        states = kept_states;
+        any_transitions = kept_any_transitions;
+        default_state_name = kept_default_state_name;
+        for (uint32_t slot = 0; slot < states.size(); ++slot) {
+            if (states[slot].is_valid()) {
+                state_index.insert(states[slot]->get_state_name(), slot);
+                _assign_state_id(states[slot].ptr(), slot);
+                _claim_state(states[slot].ptr(), true);
+            }
+        }
+        for (const Ref<StateTransition> &transition : any_transitions) {
+            _claim_any_transition(transition.ptr(), true);
+        }
+        _mark_graph_dirty();
+    }
+    update_configuration_warnings();
+    notify_property_list_changed();
+}
+
+Ref<StateMachineGraph> StateMachine::get_graph() const {
+    return graph;
+}
+
+void StateMachine::set_per_instance_states(bool p_per_instance) {
+    if (p_per_instance == per_instance_states) {
+        return;
+    }
+    ERR_FAIL_COND_MSG(running, "Stop the state machine before changing per_instance_states.");
+
+    per_instance_states = p_per_instance;
+    if (!per_instance_states && !state_copies.is_empty()) {
+        _drop_state_copies();
+        _pull_graph();
+    }
+    _mark_graph_dirty();
+}
+
+bool StateMachine::has_per_instance_states() const {
+    return per_instance_states;
+}
+
+Node *StateMachine::get_context() const {
+    return context;
+}
+
+void StateMachine::set_context(Node *p_context) {
+    if (context == p_context) {
+        return;
+    }
+
+    context = p_context;
+
+    emit_signal("context_changed", get_context());
+    for (Ref<State> state : states) {
+        state->emit_changed();
+        TypedArray<StateTransition> transitions = state->get_all_transitions();
+        for (uint64_t idx = 0; idx < transitions.size(); ++idx) {
+            cast_to<StateTransition>(transitions[idx])->emit_changed();
+        }
+    }
+}
+
+void StateMachine::set_max_transitions_per_tick(int64_t p_max) {
+    max_transitions_per_tick = MAX(p_max, 1);
+}
+
+int64_t StateMachine::get_max_transitions_per_tick() const {
+    return max_transitions_per_tick;
+}
+
+void StateMachine::set_max_chain_depth(int64_t p_depth) {
+    max_chain_depth = MAX(p_depth, 0);
+}
+
+int64_t StateMachine::get_max_chain_depth() const {
+    return max_chain_depth;
+}
+
+void StateMachine::set_transition_queue_capacity(int64_t p_capacity) {
+    ERR_FAIL_COND_MSG(p_capacity < 1 || p_capacity > (1 << 16), "Transition queue capacity must be between 1 and 65536.");
+    if (uint32_t(p_capacity) == transition_queue.get_capacity()) {
+        return;
+    }
+    ERR_FAIL_COND_MSG(running, "Stop the state machine before resizing its transition queue.");
+
+    // a thread that already posted may post again at any time, freeing the cells under it is not safe
+    uint8_t expected = TRANSITION_QUEUE_UNUSED;
+    ERR_FAIL_COND_MSG(!transition_queue_state.compare_exchange_strong(expected, TRANSITION_QUEUE_RESIZING, std::memory_order_acq_rel),
+        "Cannot resize the transition queue after a transition was queued, set the capacity before other threads start posting.");
+    transition_queue.resize(p_capacity);
+    transition_queue_state.store(TRANSITION_QUEUE_UNUSED, std::memory_order_release);
+}
+
+int64_t StateMachine::get_transition_queue_capacity() const {
+    return transition_queue.get_capacity();
+}
+
+void StateMachine::set_server_driven(bool p_server_driven) {
+    if (p_server_driven == server_driven) {
+        return;
+    }
+
+    // hand the frame callbacks that are currently being delivered over to the other mechanism
+    uint8_t frame_callbacks = processing_callbacks & (CALLBACK_BIT(CALLBACK_PROCESS) | CALLBACK_BIT(CALLBACK_PHYSICS_PROCESS));
+    for (StateCallback cb : { CALLBACK_PROCESS, CALLBACK_PHYSICS_PROCESS }) {
+        if (frame_callbacks & CALLBACK_BIT(cb)) {
+            _set_frame_callback(cb, false);
+        }
+    }
+    server_driven = p_server_driven;
+    for (StateCallback cb : { CALLBACK_PROCESS, CALLBACK_PHYSICS_PROCESS }) {
+        if (frame_callbacks & CALLBACK_BIT(cb)) {
+            _set_frame_callback(cb, true);
+        }
+    }
+}
+
+bool StateMachine::is_server_driven() const {
+    return server_driven;
+}
+
+void StateMachine::set_lod_mode(LodMode p_mode) {
+    lod_mode = p_mode;
+    lod_tier = LOD_TIER_FULL;
+    // pick the tier on the next tick
+    lod_refresh_remaining[CALLBACK_PROCESS] = 0.0;
+    lod_refresh_remaining[CALLBACK_PHYSICS_PROCESS] = 0.0;
+    _check_lod_visibility_notifier();
+}
+
+StateMachine::LodMode StateMachine::get_lod_mode() const {
+    return lod_mode;
+}
+
+void StateMachine::set_lod_reduced_distance(double p_distance) {
+    lod_reduced_distance = MAX(p_distance, 0.0);
+}
+
+double StateMachine::get_lod_reduced_distance() const {
+    return lod_reduced_distance;
+}
+
+void StateMachine::set_lod_sleep_distance(double p_distance) {
+    lod_sleep_distance = MAX(p_distance, 0.0);
+}
+
+double StateMachine::get_lod_sleep_distance() const {
+    return lod_sleep_distance;
+}
+
+void StateMachine::set_lod_visibility_notifier(const NodePath &p_path) {
+    lod_visibility_notifier = p_path;
+    _check_lod_visibility_notifier();
+}
+
+NodePath StateMachine::get_lod_visibility_notifier() const {
+    return lod_visibility_notifier;
+}
+
+void StateMachine::set_lod_offscreen_tier(LodTier p_tier) {
+    lod_offscreen_tier = p_tier;
+}
+
+StateMachine::LodTier StateMachine::get_lod_offscreen_tier() const {
+    return lod_offscreen_tier;
+}
+
+void StateMachine::set_lod_reduced_interval(double p_interval) {
+    lod_reduced_interval = MAX(p_interval, 0.0);
+}
+
+double StateMachine::get_lod_reduced_interval() const {
+    return lod_reduced_interval;
+}
+
+StateMachine::LodTier StateMachine::get_lod_tier() const {
+    return lod_tier;
+}
+
+void StateMachine::set_stagger_evaluation(bool p_stagger) {
+    if (p_stagger != stagger_evaluation) {
+        stagger_evaluation = p_stagger;
+        if (running) {
+            _reset_intervals(active_state_idx);
+        }
+    }
+}
+
+bool StateMachine::is_staggering_evaluation() const {
+    return stagger_evaluation;
+}
+
+void StateMachine::set_auto_start(bool p_auto_start) {
+    auto_start = p_auto_start;
+}
+
+bool StateMachine::will_auto_start() const {
+    return auto_start;
+}
+
+void StateMachine::set_run_in_editor(bool p_run_in_editor) {
+    if (p_run_in_editor != run_in_editor) {
+        run_in_editor = p_run_in_editor;
+        if (run_in_editor && auto_start) {
+            callable_mp(this, &StateMachine::_auto_start).call_deferred();
+        }
+    }
+}
+
+bool StateMachine::will_run_in_editor() const {
+    return run_in_editor;
+}
+
+bool StateMachine::is_running() const {
+    return running;
+}
+
+void StateMachine::start(StringName p_state, Ref<StateInput> p_input) {
+    if (!_editor_check()) {
+        return;
+    }
+
+    ERR_FAIL_COND_MSG(locked_out, "State machine cannot restart while transition is ongoing.");
+    CurrentMachineScope machine_scope(this);
+    
+    int64_t starting_slot = _get_slot(p_state.is_empty() ? default_state_name : p_state);
+    ERR_FAIL_COND_MSG(starting_slot < 0, "Invalid starting state, cannot start state machine.");
+    _materialize_state(starting_slot);
+    Ref<State> starting_state = states[starting_slot];
+
+    if (running) {
+        stop();
+    }
+
+    // catch any script reloads that happened since the override masks were last cached
+    for (const Ref<State> &state : states) {
+        state->_update_callbacks();
+        for (const Ref<StateTransition> &transition : state->transitions) {
+            transition->_update_callbacks();
+        }
+    }
+    for (const Ref<StateTransition> &transition : any_transitions) {
+        if (transition.is_valid()) {
+            transition->_update_callbacks();
+        }
+    }
+    _bake();
+
+    locked_out = true;
+    GDVIRTUAL_CALL(_start, starting_state, p_input);
+    GDVIRTUAL_CALL_PTR(starting_state, _start, p_input);
+    running = true;
+    _reset_any_intervals();
+    _activate_state(starting_slot, p_input);
+    locked_out = false;
+
+    emit_signal("started", starting_state, p_input);
+    _update_processing();
+    _flush_reentrant_transitions();
+    if (transition_queue_pending.load(std::memory_order_acquire)) {
+        _drain_transition_queue();
+    }
+}
+
+bool StateMachine::transition_to(StringName p_state, Ref<StateInput> p_input) {
+    if (!_editor_check()) {
+        return false;
+    }
+
+    int64_t slot = _get_slot(p_state);
+    ERR_FAIL_COND_V_MSG(slot < 0, false, "Invalid state name passed in.");
+
+    return _transition_to_slot(slot, p_input);
+}
+
+bool StateMachine::transition_to_id(int64_t p_id, Ref<StateInput> p_input) {
+    if (!_editor_check()) {
+        return false;
+    }
+
+    int64_t slot = _get_slot_by_id(p_id);
+    ERR_FAIL_COND_V_MSG(slot < 0, false, "Invalid state id passed in.");
+
+    return _transition_to_slot(slot, p_input);
+}
+
+bool StateMachine::_transition_to_slot(uint32_t p_slot, const Ref<StateInput> &p_input) {
+    ERR_FAIL_UNSIGNED_INDEX_V(p_slot, states.size(), false);
+
+    if (locked_out) {
+        // requested from a start, transition or activation callback: run it once the current one is done
+        reentrant_transitions.push_back(ReentrantTransition{ states[p_slot]->get_state_id(), p_input });
+        return true;
+    }
+
+    bool success = _run_transition(p_slot, p_input);
+    _flush_reentrant_transitions();
+    return success;
+}
+
+void StateMachine::_flush_reentrant_transitions() {
+    if (flushing_reentrant || reentrant_transitions.is_empty()) {
+        return; // transitions run by the loop below land here too, the outer loop picks up what they queue
+    }
+
+    flushing_reentrant = true;
+    int64_t depth = 0;
+    while (!reentrant_transitions.is_empty()) {
+        if (!running) {
+            reentrant_transitions.clear();
+            break;
+        }
+        if (depth >= max_chain_depth) {
+            ERR_PRINT("Transitions requested during transitions went past max_chain_depth, dropping " + itos(reentrant_transitions.size()) + " of them.");
+            reentrant_transitions.clear();
+            break;
+        }
+
+        ReentrantTransition next = reentrant_transitions[0];
+        reentrant_transitions.remove_at(0);
+        ++depth;
+
+        int64_t slot = _get_slot_by_id(next.state_id);
+        ERR_CONTINUE_MSG(slot < 0, "A state requested during a transition was removed before it could run.");
+        _run_transition(slot, next.input);
+    }
+    flushing_reentrant = false;
+}
+
+bool StateMachine::_run_transition(uint32_t p_slot, const Ref<StateInput> &p_input) {
+    ERR_FAIL_COND_V_MSG(!running, false, "State machine must be started before it can transition.");
+    ERR_FAIL_UNSIGNED_INDEX_V(p_slot, states.size(), false);
+
+    _bake();
+    if (!(baked_state_flags[p_slot] & BAKED_STATE_ENABLED)) {
+        return false;
+    }
+    ERR_FAIL_COND_V_MSG(
+        p_slot == active_state_idx && !(baked_state_flags[p_slot] & BAKED_STATE_TRANSITIONS_TO_SELF),
+        false, "State requested to transition to itself, but was disallowed from doing so.");
+    _materialize_state(p_slot);
+
+    Ref<State> next_state = states[p_slot];
+    Ref<State> cur_state = get_active_state();
+
+    CurrentMachineScope machine_scope(this);
+    locked_out = true;
+    const Ref<StateInput> &input = _ready_transition_input(p_input);
+
+    bool cont_with_transition = true;
+    GDVIRTUAL_CALL(_transition, next_state, input, cont_with_transition);
+    if (!cont_with_transition) { // when machine script virtual method request a transition abort
+        locked_out = false;
+        return false;
+    }
+
+    GDVIRTUAL_CALL_PTR(next_state, _can_activate, input, cont_with_transition);
+    if (!cont_with_transition) { // when state virtual method says transition is invalid
+        locked_out = false;
+        return false;
+    }
+
+    Ref<State> prev_state = cur_state;
+    if (prev_state.is_valid()) {
+        _deactivate_state();
+    }
+
+    _activate_state(p_slot, input);
+    locked_out = false;
+
+    emit_signal("transitioned", prev_state, next_state, input);
+    _update_processing();
+    return true;
+}
+
+bool StateMachine::queue_transition(const Variant &p_state, const Ref<StateInput> &p_input) {
+    QueuedTransition request;
+    switch (p_state.get_type()) {
+        case Variant::INT:
+            request.state_id = p_state;
+            break;
+        case Variant::STRING:
+        case Variant::STRING_NAME:
+            request.state = p_state;
+            break;
+        default:
+            ERR_FAIL_V_MSG(false, "Queued transitions take a state name or a state id.");
+    }
+    request.input = p_input;
+
+    if (transition_queue_state.load(std::memory_order_acquire) != TRANSITION_QUEUE_POSTED) {
+        uint8_t expected = TRANSITION_QUEUE_UNUSED;
+        if (!transition_queue_state.compare_exchange_strong(expected, TRANSITION_QUEUE_POSTED, std::memory_order_acq_rel)) {
+            ERR_FAIL_COND_V_MSG(expected == TRANSITION_QUEUE_RESIZING, false, "Transition queue is being resized, the request was dropped.");
+        }
+    }
+    ERR_FAIL_COND_V_MSG(!transition_queue.push(request), false, "Transition queue is full, the request was dropped.");
+    if (!transition_queue_pending.exchange(true, std::memory_order_acq_rel)) {
+        // one deferred call per batch, for machines that aren't ticking; a tick drains the queue sooner
+        callable_mp(this, &StateMachine::_drain_transition_queue).call_deferred();
+    }
+    return true;
+}
+
+void StateMachine::_drain_transition_queue() {
+    if (locked_out) {
+        callable_mp(this, &StateMachine::_drain_transition_queue).call_deferred();
+        return;
+    }
+
+    if (!running) {
+        return; // requests posted while stopped wait in the queue for start()
+    }
+
+    // an exchange rather than a store, so a push that found the flag still set is visible to the pops below
+    transition_queue_pending.exchange(false, std::memory_order_acq_rel);
+    QueuedTransition request;
+    while (transition_queue.pop(request)) {
+        int64_t slot = request.state_id >= 0 ? _get_slot_by_id(request.state_id) : _get_slot(request.state);
+        ERR_CONTINUE_MSG(slot < 0, "Queued transition names a state that is not in the state machine.");
+        _transition_to_slot(slot, request.input);
+        if (!running) {
+            // stopped by the request just applied, the rest is kept for the next start()
+            transition_queue_pending.store(true, std::memory_order_release);
+            break;
+        }
+    }
+}
+
+void StateMachine::sleep() {
+    ERR_FAIL_COND_MSG(!running, "State machine must be started before it can sleep.");
+    if (!sleeping) {
+        sleeping = true;
+        _update_processing();
+    }
+}
+
+void StateMachine::wake() {
+    if (sleeping) {
+        sleeping = false;
+        _update_processing();
+    }
+}
+
+bool StateMachine::is_sleeping() const {
+    return sleeping;
+}
+
+bool StateMachine::send_event(const StringName &p_event, const Ref<StateInput> &p_input) {
+    if (!_editor_check() || !running) {
+        return false;
+    }
+
+    _bake();
+    uint32_t version = bake_version;
+    uint32_t active_slot = active_state_idx;
+
+    // any-state transitions are filed under the slot one past the last state
+    const LocalVector<uint32_t> *any_listening = baked_event_transitions.getptr(BakedEventKey{ p_event, baked_state_flags.size() });
+    for (uint32_t idx = 0; nullptr != any_listening && _is_bake_current(version) && idx < any_listening->size(); ++idx) {
+        uint32_t transition = (*any_listening)[idx];
+        if (_is_any_excluded(transition, active_slot)) {
+            continue;
+        }
+        const Ref<StateInput> &input = p_input.is_valid() ? p_input : baked_transitions[transition]->input;
+        if (_fire_baked_transition(transition, input)) {
+            return true;
+        }
+    }
+
+    const LocalVector<uint32_t> *listening = baked_event_transitions.getptr(BakedEventKey{ p_event, active_slot });
+    for (uint32_t idx = 0; nullptr != listening && _is_bake_current(version) && idx < listening->size(); ++idx) {
+        uint32_t transition = (*listening)[idx];
+        const Ref<StateInput> &input = p_input.is_valid() ? p_input : baked_transitions[transition]->input;
+        if (_fire_baked_transition(transition, input)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void StateMachine::stop() {
+    if (!_editor_check()) {
+        return;
+    }
+
+    ERR_FAIL_COND_MSG(locked_out, "State machine cannot be stopped while transition ongoing.");
+    ERR_FAIL_COND_MSG(!running, "State machine must be started before it can stop.");
+    CurrentMachineScope machine_scope(this);
+
+    locked_out = true;
+    GDVIRTUAL_CALL(_stop);
+
+    Ref<State> stopped_state = get_active_state();
+    if (stopped_state.is_valid()) {
+        _deactivate_state();
+        GDVIRTUAL_CALL_PTR(stopped_state, _stop);
+    }
+
+    locked_out = false;
+    running = false;
+    sleeping = false;
+    reentrant_transitions.clear();
+    _discard_timers();
+    active_state_id.store(-1, std::memory_order_release);
+
+    emit_signal("stopped", stopped_state);
+    _update_processing();
+}
+
+bool StateMachine::_editor_check() const {
+    return run_in_editor || !Engine::get_singleton()->is_editor_hint();
+}
+
+void StateMachine::_auto_start() {
+    if (auto_start && !running) { // just in case user called start() in _ready()
+        start();
+    }
+}
+
+const Ref<StateInput> &StateMachine::_ready_transition_input(const Ref<StateInput> &p_input) {
+    // reuse one input per machine instead of allocating one for every transition requested without it.  A script
+    // that kept a reference to the last one gets to keep it and the next transition receives a fresh input; the
+    // reference count is the only check, since this runs on every transition.
+    if (p_input.is_null() && (default_input.is_null() || default_input->get_reference_count() > 1)) {
+        default_input.instantiate();
+    }
+    const Ref<StateInput> &input = p_input.is_null() ? default_input : p_input;
+
+    State *active_state = _get_active_state_ptr();
+    if (nullptr != active_state) {
+        input->previous_state = active_state->get_state_name();
+    } else {
+        input->previous_state = StringName();
+    }
+
+    return input;
+}
+
+void StateMachine::_activate_state(uint32_t p_slot, const Ref<StateInput> &p_input) {
+    ERR_FAIL_UNSIGNED_INDEX(p_slot, states.size());
+
+    ++activation_serial;
+    _discard_timers();
+    active_state_idx = p_slot;
+    active_state_id.store(states[p_slot]->get_state_id(), std::memory_order_release);
+    // activating a state wakes the machine unless the new state only waits for events.  Set before _activate()
+    // so a sleep() or wake() made from it sticks.
+    sleeping = baked_state_flags[p_slot] & BAKED_STATE_SLEEPS_UNTIL_EVENT;
+    GDVIRTUAL_CALL_PTR(states[p_slot], _activate, p_input);
+    _reset_intervals(p_slot);
+    _arm_timeouts(p_slot);
+    _connect_signals(p_slot);
+}
+
+void StateMachine::_arm_timeouts(uint32_t p_slot) {
+    _bake();
+    if (!(baked_state_flags[p_slot] & BAKED_STATE_HAS_TIMEOUTS) || !is_inside_tree()) {
+        return;
+    }
+
+    for (uint32_t idx = baked_transition_offsets[p_slot]; idx < baked_transition_offsets[p_slot + 1]; ++idx) {
+        StateTransition *transition = baked_transitions[idx];
+        if (transition->timeout > 0.0) {
+            double delay = transition->timeout;
+            if (transition->timeout_jitter > 0.0) {
+                delay += UtilityFunctions::randf_range(0.0, transition->timeout_jitter);
+            }
+            TransitionTimers::arm(this, activation_serial, transition->get_instance_id(), delay);
+        }
+    }
+}
+
+void StateMachine::_discard_timers() {
+    if (armed_timers > 0) {
+        TransitionTimers::discard(armed_timers);
+        armed_timers = 0;
+    }
+}
+
+bool StateMachine::_timer_expired(uint32_t p_serial, uint64_t p_transition_id) {
+    if (!running || p_serial != activation_serial) {
+        return true; // the state it was armed for is no longer active
+    }
+    if (locked_out || !can_process()) {
+        return false;
+    }
+
+    _fire_active_transition(p_transition_id);
+    return true;
+}
+
+void StateMachine::_reset_intervals(uint32_t p_slot) {
+    _bake();
+    _reset_interval_range(baked_callback_offsets[p_slot * CALLBACK_MAX], baked_callback_offsets[(p_slot + 1) * CALLBACK_MAX]);
+}
+
+void StateMachine::_reset_any_intervals() {
+    _bake();
+    _reset_interval_range(baked_any_callback_offsets[0], baked_any_callback_offsets[CALLBACK_MAX]);
+}
+
+bool StateMachine::_is_any_excluded(uint32_t p_transition, uint32_t p_slot) const {
+    return baked_any_excluded[(p_transition - baked_any_first) * baked_state_flags.size() + p_slot];
+}
+
+void StateMachine::_reset_interval_range(uint32_t p_first, uint32_t p_end) {
+    for (uint32_t idx = p_first; idx < p_end; ++idx) {
+        double interval = baked_callback_intervals[idx];
+        if (interval <= 0.0) {
+            continue;
+        }
+
+        // the first check happens on the next tick, or somewhere inside the first interval when staggering,
+        // with the offset derived from the instance so a crowd of machines spreads out over the interval
+        double phase = 0.0;
+        if (stagger_evaluation) {
+            uint32_t hash = hash_murmur3_one_32(idx, hash_murmur3_one_64(get_instance_id()));
+            phase = double(hash) / double(UINT32_MAX);
+        }
+        interval_remaining[idx] = phase * interval;
+        interval_elapsed[idx] = 0.0;
+    }
+}
+
+static uint64_t _interval_key(const StateTransition *p_transition, uint32_t p_callback) {
+    // the address is only compared, the transition may have been freed since the last bake
+    return uint64_t(uintptr_t(p_transition)) * CALLBACK_MAX + p_callback;
+}
+
+void StateMachine::_save_interval_countdowns(HashMap<uint64_t, IntervalCountdown> &r_countdowns) const {
+    uint32_t state_count = baked_state_flags.size();
+    for (uint32_t cb = 0; cb < CALLBACK_MAX; ++cb) {
+        // the last pass covers the any-state transitions
+        for (uint32_t slot = 0; slot <= state_count; ++slot) {
+            uint32_t first = slot < state_count ? baked_callback_offsets[slot * CALLBACK_MAX + cb] : baked_any_callback_offsets[cb];
+            uint32_t end = slot < state_count ? baked_callback_offsets[slot * CALLBACK_MAX + cb + 1] : baked_any_callback_offsets[cb + 1];
+            for (uint32_t idx = first; idx < end; ++idx) {
+                if (baked_callback_intervals[idx] > 0.0) {
+                    r_countdowns.insert(_interval_key(baked_transitions[baked_callback_transitions[idx]], cb),
+                        IntervalCountdown{ interval_remaining[idx], interval_elapsed[idx] });
+                }
+            }
+        }
+    }
+}
+
+void StateMachine::_restore_interval_countdowns(const HashMap<uint64_t, IntervalCountdown> &p_countdowns) {
+    if (p_countdowns.is_empty()) {
+        return;
+    }
+
+    uint32_t state_count = baked_state_flags.size();
+    for (uint32_t cb = 0; cb < CALLBACK_MAX; ++cb) {
+        for (uint32_t slot = 0; slot <= state_count; ++slot) {
+            uint32_t first = slot < state_count ? baked_callback_offsets[slot * CALLBACK_MAX + cb] : baked_any_callback_offsets[cb];
+            uint32_t end = slot < state_count ? baked_callback_offsets[slot * CALLBACK_MAX + cb + 1] : baked_any_callback_offsets[cb + 1];
+            for (uint32_t idx = first; idx < end; ++idx) {
+                double interval = baked_callback_intervals[idx];
+                if (interval <= 0.0) {
+                    continue;
+                }
+                const IntervalCountdown *saved = p_countdowns.getptr(_interval_key(baked_transitions[baked_callback_transitions[idx]], cb));
+                if (nullptr != saved) {
+                    interval_remaining[idx] = MIN(saved->remaining, interval); // the interval may have been shortened
+                    interval_elapsed[idx] = saved->elapsed;
+                }
+            }
+        }
+    }
+}
+
+bool StateMachine::_advance_interval(uint32_t p_entry, double p_delta, double &r_delta) {
+    double interval = baked_callback_intervals[p_entry];
+    interval_elapsed[p_entry] += p_delta;
+    interval_remaining[p_entry] -= baked_callback_interval_frames[p_entry] ? 1.0 : p_delta;
+    if (interval_remaining[p_entry] > 0.0) {
+        return false;
+    }
+
+    interval_remaining[p_entry] += interval;
+    if (interval_remaining[p_entry] <= 0.0) {
+        // fell more than an interval behind, e.g. after a hitch; don't try to catch up
+        interval_remaining[p_entry] = interval;
+    }
+    r_delta = interval_elapsed[p_entry];
+    interval_elapsed[p_entry] = 0.0;
+    return true;
+}
+
+void StateMachine::_connect_signals(uint32_t p_slot) {
+    _bake();
+    if (!(baked_state_flags[p_slot] & BAKED_STATE_HAS_SIGNALS)) {
+        return;
+    }
+
+    Node *base = nullptr != context ? context : this;
+    for (uint32_t idx = baked_transition_offsets[p_slot]; idx < baked_transition_offsets[p_slot + 1]; ++idx) {
+        StateTransition *transition = baked_transitions[idx];
+        if (transition->signal_name.is_empty()) {
+            continue;
+        }
+
+        Node *source = transition->signal_source.is_empty() ? base : base->get_node_or_null(transition->signal_source);
+        ERR_CONTINUE_MSG(nullptr == source, "Cannot find signal source '" + String(transition->signal_source) + "' for transition to '" + String(transition->to_state_name) + "'.");
+
+        SignalConnection connection;
+        connection.source_id = source->get_instance_id();
+        connection.signal = transition->signal_name;
+        connection.callable = Callable(this, "_on_transition_signal").bind(activation_serial, transition->get_instance_id());
+        ERR_CONTINUE(source->connect(connection.signal, connection.callable) != OK);
+        signal_connections.push_back(connection);
+    }
+}
+
+void StateMachine::_disconnect_signals() {
+    for (uint32_t idx = 0; idx < signal_connections.size(); ++idx) {
+        const SignalConnection &connection = signal_connections[idx];
+        Object *source = ObjectDB::get_instance(connection.source_id);
+        if (nullptr != source && source->is_connected(connection.signal, connection.callable)) {
+            source->disconnect(connection.signal, connection.callable);
+        }
+    }
+    signal_connections.clear();
+}
+
+Variant StateMachine::_on_transition_signal(const Variant **p_args, GDExtensionInt p_argc, GDExtensionCallError &r_error) {
+    r_error.error = GDEXTENSION_CALL_OK;
+    // the activation serial and transition id are bound after whatever arguments the signal emits
+    ERR_FAIL_COND_V(p_argc < 2, Variant());
+    uint32_t serial = *p_args[p_argc - 2];
+    uint64_t transition_id = *p_args[p_argc - 1];
+
+    if (running && serial == activation_serial) {
+        _fire_active_transition(transition_id);
+    }
+    return Variant();
+}
+
+bool StateMachine::_fire_active_transition(uint64_t p_transition_id) {
+    _bake();
+    for (uint32_t idx = baked_transition_offsets[active_state_idx]; idx < baked_transition_offsets[active_state_idx + 1]; ++idx) {
+        if (baked_transitions[idx]->get_instance_id() == p_transition_id) {
+            return _fire_baked_transition(idx, baked_transitions[idx]->input);
+        }
+    }
+
+    return false;
+}
+
+void StateMachine::_deactivate_state() {
+    Ref<State> prev_state = get_active_state();
+    ERR_FAIL_NULL(prev_state);
+
+    _disconnect_signals();
+    GDVIRTUAL_CALL_PTR(prev_state, _deactivate);
+    prev_state.unref();
+}
+
+State *StateMachine::_get_active_state_ptr() const {
+    if (running && active_state_idx < states.size()) {
+        return states[active_state_idx].ptr();
+    } else {
+        return nullptr;
+    }
+}
+
+void StateMachine::_graph_changed() {
+    if (batch_depth > 0) {
+        // the bake can't go stale, but publishing and rescheduling callbacks wait for end_batch()
+        graph_dirty = true;
+        batch_graph_changed = true;
+        return;
+    }
+
+    // edits to this instance's own copies never get here, see State::_graph_changed()
+    if (graph.is_valid()) {
+        graph->_publish(this);
+    }
+    _mark_graph_dirty();
+}
+
+void StateMachine::_mark_graph_dirty() {
+    graph_dirty = true;
+
+    // the engine may not be calling into this node anymore, so the lists can't wait for the next tick
+    if (running && !processing_update_queued) {
+        processing_update_queued = true;
+        callable_mp(this, &StateMachine::_update_processing).call_deferred();
+    }
+}
+
+void StateMachine::_pull_graph() {
+    // another user of the shared graph changed it, rebuild this instance's lookups from the new topology
+    int64_t active_id = -1;
+    if (running) {
+        const Ref<State> &active = states[active_state_idx];
+        bool kept = false;
+        for (const Ref<State> &state : graph->states) {
+            const Ref<State> *copy = state_copies.getptr(state.ptr());
+            if (state == active || (nullptr != copy && *copy == active)) {
+                kept = true;
+                break;
+            }
+        }
+        if (kept) {
+            active_id = active->get_state_id();
+        } else {
+            stop();
+        }
+    }
+
+    states = graph->states;
+    any_transitions = graph->any_transitions;
+    default_state_name = graph->default_state_name;
+    state_index.clear();
+    id_slots.clear();
+    HashMap<const State *, Ref<State>> copies;
+    HashMap<StringName, State *> renamed; // old name -> copy whose template was renamed
+    for (uint32_t slot = 0; slot < states.size(); ++slot) {
+        const Ref<State> *copy = state_copies.getptr(states[slot].ptr());
+        if (nullptr != copy) {
+            // names are topology, a copy follows its template's
+            if ((*copy)->state_name != states[slot]->state_name) {
+                renamed.insert((*copy)->state_name, copy->ptr());
+                (*copy)->state_name = states[slot]->state_name;
+            }
+            copies.insert(states[slot].ptr(), *copy);
+            states.write[slot] = *copy;
+        }
+        if (states[slot].is_valid()) {
+            state_index.insert(states[slot]->get_state_name(), slot);
+            _assign_state_id(states[slot].ptr(), slot);
+        }
+    }
+    for (const KeyValue<const State *, Ref<State>> &E : state_copies) {
+        if (!copies.has(E.key)) {
+            E.value->_set_state_machine(nullptr);
+        }
+    }
+    state_copies = copies;
+    if (!enabled_overrides.is_empty()) {
+        HashMap<const State *, bool> overrides;
+        for (const Ref<State> &state : graph->states) {
+            const bool *enabled = enabled_overrides.getptr(state.ptr());
+            if (nullptr != enabled) {
+                overrides.insert(state.ptr(), *enabled);
+            }
+        }
+        enabled_overrides = overrides;
+    }
+    for (const KeyValue<StringName, State *> &E : renamed) {
+        for (const KeyValue<const State *, Ref<State>> &C : state_copies) {
+            for (const Ref<StateTransition> &transition : C.value->transitions) {
+                _retarget_transition(transition.ptr(), E.value, E.key);
+            }
+        }
+    }
+    if (running) {
+        active_state_idx = _get_slot_by_id(active_id);
+    }
+    _mark_graph_dirty();
+}
+
+void StateMachine::_materialize_state(uint32_t p_slot) const {
+    if (!per_instance_states || graph.is_null() || !_editor_check()) {
+        return;
+    }
+    const Ref<State> &state = states[p_slot];
+    if (state.is_null() || state->machine == this) {
+        return; // already this machine's copy
+    }
+
+    // queries are const, but handing out a private copy instead of the shared one doesn't change the graph
+    StateMachine *self = const_cast<StateMachine *>(this);
+    Ref<State> copy = _duplicate_state(state);
+    copy->_set_state_machine(self);
+    self->state_copies.insert(state.ptr(), copy);
+    self->enabled_overrides.erase(state.ptr()); // the copy has its own flag now
+    self->states.write[p_slot] = copy;
+    self->_mark_graph_dirty();
+}
+
+Ref<State> StateMachine::_duplicate_state(const Ref<State> &p_state) const {
+    Ref<State> copy = p_state->duplicate(true);
+    copy->enabled = _is_state_enabled(p_state.ptr());
+    // every transition has to be the copy's own, a shared one would be re-parented away from the template
+    // and would run the same script instance for every machine
+    for (int64_t idx = 0; idx < copy->transitions.size(); ++idx) {
+        const Ref<StateTransition> &transition = copy->transitions[idx];
+        if (transition.is_valid() && transition->from_state != copy) {
+            copy->transitions.write[idx] = p_state->transitions[idx]->_duplicate_for(copy.ptr());
+        }
+    }
+    return copy;
+}
+
+bool StateMachine::_is_state_enabled(const State *p_state) const {
+    const bool *enabled = enabled_overrides.getptr(p_state);
+    return nullptr == enabled ? p_state->enabled : *enabled;
+}
+
+void StateMachine::_override_state_enabled(const State *p_state, bool p_enabled) {
+    if (_is_state_enabled(p_state) == p_enabled) {
+        return;
+    }
+
+    // only this machine rebakes, nothing is published to the others
+    enabled_overrides.insert(p_state, p_enabled);
+    _mark_graph_dirty();
+}
+
+State *StateMachine::_get_template(const State *p_copy) const {
+    for (const KeyValue<const State *, Ref<State>> &E : state_copies) {
+        if (E.value.ptr() == p_copy) {
+            return const_cast<State *>(E.key);
+        }
+    }
+    return nullptr;
+}
+
+Vector<Ref<State>> StateMachine::_get_graph_states() const {
+    if (state_copies.is_empty()) {
+        return states;
+    }
+
+    // the graph keeps the templates, this machine's copies of them stay its own
+    HashMap<const State *, State *> templates;
+    for (const KeyValue<const State *, Ref<State>> &E : state_copies) {
+        templates.insert(E.value.ptr(), const_cast<State *>(E.key));
+    }
+    Vector<Ref<State>> out = states;
+    Ref<State> *ptr = out.ptrw();
+    for (int64_t slot = 0; slot < out.size(); ++slot) {
+        State *const *state_template = templates.getptr(ptr[slot].ptr());
+        if (nullptr != state_template) {
+            ptr[slot] = Ref<State>(*state_template);
+        }
+    }
+    return out;
+}
+
+void StateMachine::_drop_state_copies() {
+    for (const KeyValue<const State *, Ref<State>> &E : state_copies) {
+        E.value->_set_state_machine(nullptr);
+    }
+    state_copies.clear();
+}
+
+void StateMachine::_claim_state(State *p_state, bool p_claim) {
+    // states of a shared graph point at the graph, the machine running them is looked up per callback
+    if (graph.is_valid()) {
+        p_state->graph = p_claim ? graph.ptr() : nullptr;
+    } else {
+        p_state->_set_state_machine(p_claim ? this : nullptr);
+    }
+}
+
+void StateMachine::_claim_any_transition(StateTransition *p_transition, bool p_claim) {
+    if (graph.is_valid()) {
+        p_transition->any_graph = p_claim ? graph.ptr() : nullptr;
+    } else {
+        p_transition->any_machine = p_claim ? this : nullptr;
+    }
+}
+
+bool StateMachine::_owns_state(const State *p_state) const {
+    return p_state->machine == this || (graph.is_valid() && p_state->graph == graph.ptr());
+}
+
+StateMachine *StateMachine::_get_current_machine() {
+    return current_machine;
+}
+
+void StateMachine::_bake() {
+    if (!graph_dirty) {
+        return;
+    }
+
+    // an edit to a running machine would otherwise make every throttled transition run on the next tick
+    HashMap<uint64_t, IntervalCountdown> countdowns;
+    if (running) {
+        _save_interval_countdowns(countdowns);
+    }
+
+    uint32_t state_count = states.size();
+    baked_state_flags.resize(state_count);
+    baked_active_callbacks.resize(state_count);
+    baked_inactive_callbacks.resize(state_count);
+    baked_thread_safe_transitions.resize(state_count);
+    baked_chain_stamps.resize(state_count);
+    baked_thread_safe_states = CALLBACK_BIT(CALLBACK_MAX) - 1;
+    baked_shared_callbacks = 0;
+    baked_transition_offsets.resize(state_count + 1);
+    baked_callback_offsets.resize(state_count * CALLBACK_MAX + 1);
+    baked_transitions.clear();
+    baked_transition_targets.clear();
+    baked_callback_transitions.clear();
+    baked_callback_intervals.clear();
+    baked_callback_interval_frames.clear();
+    baked_event_transitions.clear();
+    for (uint32_t cb = 0; cb < CALLBACK_MAX; ++cb) {
+        baked_callback_states[cb].clear();
+        baked_inactive_counts[cb] = 0;
+    }
+
+    for (uint32_t slot = 0; slot < state_count; ++slot) {
+        State *state = states[slot].ptr();
+        baked_transition_offsets[slot] = baked_transitions.size();
+
+        if (nullptr == state) {
+            baked_state_flags[slot] = 0;
+            baked_active_callbacks[slot] = 0;
+            baked_inactive_callbacks[slot] = 0;
+            baked_thread_safe_transitions[slot] = 0;
+            for (uint32_t cb = 0; cb < CALLBACK_MAX; ++cb) {
+                baked_callback_offsets[slot * CALLBACK_MAX + cb] = baked_callback_transitions.size();
+            }
+            continue;
+        }
+
+        uint8_t flags = 0;
+        if (_is_state_enabled(state.ptr())) {
+            flags |= BAKED_STATE_ENABLED;
+        }
+        if (state->can_transition_to_self()) {
+            flags |= BAKED_STATE_TRANSITIONS_TO_SELF;
+        }
+        if (state->will_sleep_until_event()) {
+            flags |= BAKED_STATE_SLEEPS_UNTIL_EVENT;
+        }
+        // a state this instance hasn't copied yet is still the graph's, and has no per-instance data to update
+        uint8_t inactive_callbacks = state->inactive_callbacks;
+        if (per_instance_states && graph.is_valid() && state->machine != this) {
+            inactive_callbacks = 0;
+        }
+        baked_active_callbacks[slot] = state->active_callbacks;
+        baked_inactive_callbacks[slot] = inactive_callbacks;
+
+        for (const Ref<StateTransition> &transition : state->transitions) {
+            if (transition.is_null()) {
+                continue;
+            }
+            if (transition->timeout > 0.0) {
+                flags |= BAKED_STATE_HAS_TIMEOUTS;
+            }
+            if (!transition->signal_name.is_empty()) {
+                flags |= BAKED_STATE_HAS_SIGNALS;
+            }
+            if (!transition->event.is_empty()) {
+                baked_event_transitions[BakedEventKey{ transition->event, slot }].push_back(baked_transitions.size());
+            }
+            baked_transitions.push_back(transition.ptr());
+            baked_transition_targets.push_back(_get_target_slot(transition.ptr()));
+        }
+
+        baked_state_flags[slot] = flags;
+
+        uint32_t first = baked_transition_offsets[slot];
+        uint8_t thread_safe_transitions = CALLBACK_BIT(CALLBACK_MAX) - 1;
+        for (uint32_t transition = first; transition < baked_transitions.size(); ++transition) {
+            if (!baked_transitions[transition]->thread_safe) {
+                thread_safe_transitions &= ~baked_transitions[transition]->callbacks;
+            }
+        }
+        baked_thread_safe_transitions[slot] = thread_safe_transitions;
+        if (graph.is_valid() && state->machine != this) {
+            baked_shared_callbacks |= state->active_callbacks | inactive_callbacks;
+            for (uint32_t transition = first; transition < baked_transitions.size(); ++transition) {
+                baked_shared_callbacks |= baked_transitions[transition]->callbacks;
+            }
+        }
+
+        for (uint32_t cb = 0; cb < CALLBACK_MAX; ++cb) {
+            baked_callback_offsets[slot * CALLBACK_MAX + cb] = baked_callback_transitions.size();
+            for (uint32_t transition = first; transition < baked_transitions.size(); ++transition) {
+                const StateTransition *baked = baked_transitions[transition];
+                if (baked->callbacks & CALLBACK_BIT(cb)) {
+                    // only the per-frame callbacks can be throttled, input is always delivered
+                    bool throttled = cb == CALLBACK_PROCESS || cb == CALLBACK_PHYSICS_PROCESS;
+                    baked_callback_transitions.push_back(transition);
+                    baked_callback_intervals.push_back(throttled ? baked->evaluation_interval : 0.0);
+                    baked_callback_interval_frames.push_back(baked->evaluation_interval_mode == StateTransition::INTERVAL_FRAMES);
+                }
+            }
+        }
+
+        if (!(flags & BAKED_STATE_ENABLED)) {
+            continue;
+        }
+        uint8_t overridden = state->active_callbacks | inactive_callbacks;
+        if (!state->thread_safe) {
+            baked_thread_safe_states &= ~overridden;
+        }
+        for (uint32_t cb = 0; cb < CALLBACK_MAX; ++cb) {
+            if (overridden & CALLBACK_BIT(cb)) {
+                baked_callback_states[cb].push_back(slot);
+            }
+            if (inactive_callbacks & CALLBACK_BIT(cb)) {
+                ++baked_inactive_counts[cb];
+            }
+        }
+    }
+
+    baked_transition_offsets[state_count] = baked_transitions.size();
+    baked_callback_offsets[state_count * CALLBACK_MAX] = baked_callback_transitions.size();
+
+    // any-state transitions go after every state's own, with an exclusion row per transition
+    baked_any_first = baked_transitions.size();
+    baked_any_callbacks = 0;
+    baked_thread_safe_any = CALLBACK_BIT(CALLBACK_MAX) - 1;
+    baked_any_excluded.resize(any_transitions.size() * state_count);
+    for (const Ref<StateTransition> &transition : any_transitions) {
+        if (transition.is_null()) {
+            continue;
+        }
+
+        uint32_t row = (baked_transitions.size() - baked_any_first) * state_count;
+        int64_t target = _get_target_slot(transition.ptr());
+        for (uint32_t slot = 0; slot < state_count; ++slot) {
+            // firing into the active state would only fail with an error unless it may transition to itself
+            baked_any_excluded[row + slot] = slot == target && !(baked_state_flags[slot] & BAKED_STATE_TRANSITIONS_TO_SELF);
+        }
+        const PackedStringArray &excluded = transition->excluded_states;
+        for (int64_t idx = 0; idx < excluded.size(); ++idx) {
+            int64_t slot = _get_slot(excluded[idx]);
+            if (slot >= 0) {
+                baked_any_excluded[row + slot] = 1;
+            }
+        }
+
+        if (!transition->event.is_empty()) {
+            baked_event_transitions[BakedEventKey{ transition->event, state_count }].push_back(baked_transitions.size());
+        }
+        baked_any_callbacks |= transition->callbacks;
+        if (graph.is_valid()) {
+            baked_shared_callbacks |= transition->callbacks; // any-state transitions are never copied per instance
+        }
+        if (!transition->thread_safe) {
+            baked_thread_safe_any &= ~transition->callbacks;
+        }
+        baked_transitions.push_back(transition.ptr());
+        baked_transition_targets.push_back(target);
+    }
+
+    for (uint32_t cb = 0; cb < CALLBACK_MAX; ++cb) {
+        baked_any_callback_offsets[cb] = baked_callback_transitions.size();
+        for (uint32_t transition = baked_any_first; transition < baked_transitions.size(); ++transition) {
+            const StateTransition *baked = baked_transitions[transition];
+            if (baked->callbacks & CALLBACK_BIT(cb)) {
+                bool throttled = cb == CALLBACK_PROCESS || cb == CALLBACK_PHYSICS_PROCESS;
+                baked_callback_transitions.push_back(transition);
+                baked_callback_intervals.push_back(throttled ? baked->evaluation_interval : 0.0);
+                baked_callback_interval_frames.push_back(baked->evaluation_interval_mode == StateTransition::INTERVAL_FRAMES);
+            }
+        }
+    }
+    baked_any_callback_offsets[CALLBACK_MAX] = baked_callback_transitions.size();
+
+    interval_remaining.resize(baked_callback_transitions.size());
+    interval_elapsed.resize(baked_callback_transitions.size());
+    graph_dirty = false;
+    ++bake_version;
+
+    if (running) {
+        // entries new to the active state start like on activation, the others pick up where they were
+        _reset_intervals(active_state_idx);
+        _reset_any_intervals();
+        _restore_interval_countdowns(countdowns);
+    }
+}
+
+bool StateMachine::_is_bake_current(uint32_t p_version) const {
+    return !graph_dirty && bake_version == p_version;
 }
 
-TypedArray<StateTransition> StateMachine::get_transitions_to(const Ref<State> &p_to) const {
-    ERR_FAIL_NULL_V(p_to, TypedArray<StateTransition>());
-
-    TypedArray<StateTransition> out;
-    for (const Ref<State> &state : states) {
-        Ref<StateTransition> transition = state->get_transition_to(p_to);
-        if (transition.is_valid()) {
-            out.push_back(transition);
-        }
+bool StateMachine::_resume_bake(uint32_t &r_version) {
+    // a worker leaves the baked view alone and ends its tick, the main thread rebakes before the next one
+    if (!running || deferring_transitions) {
+        return false;
     }
 
-    return out;
+    _bake();
+    r_version = bake_version;
+    return true;
 }
 
-Ref<StateTransition> StateMachine::get_transition_between(const Ref<State> &p_from, const Ref<State> &p_to) const {
-    ERR_FAIL_NULL_V(p_from, nullptr);
-    ERR_FAIL_NULL_V(p_to, nullptr);
-
-    return p_from->get_transition_to(p_to);
+uint32_t StateMachine::_next_subscribed_state(StateCallback p_callback, uint32_t p_slot) const {
+    const LocalVector<uint32_t> &subscribed = baked_callback_states[p_callback];
+    uint32_t idx = 0;
+    while (idx < subscribed.size() && subscribed[idx] <= p_slot) {
+        ++idx;
+    }
+    return idx;
 }
 
-TypedArray<StateTransition> StateMachine::get_all_transitions() const {
-    TypedArray<StateTransition> out;
-    for (const Ref<State> &state : states) {
-        out.append_array(state->get_all_transitions());
+bool StateMachine::_resume_callback_loop(int64_t p_slot, StateCallback p_callback, const StateTransition *p_transition, int64_t p_ordinal, int64_t p_count, int64_t &r_first, int64_t &r_idx, int64_t &r_end) const {
+    if (p_slot < 0) {
+        r_first = baked_any_callback_offsets[p_callback];
+        r_end = baked_any_callback_offsets[p_callback + 1];
+    } else {
+        uint32_t range = p_slot * CALLBACK_MAX + p_callback;
+        r_first = baked_callback_offsets[range];
+        r_end = baked_callback_offsets[range + 1];
     }
-    return out;
+
+    for (int64_t idx = r_first; idx < r_end; ++idx) {
+        if (baked_transitions[baked_callback_transitions[idx]] == p_transition) {
+            r_idx = idx;
+            return true;
+        }
+    }
+
+    // a state materialized for this machine brings copies of its transitions, in the same order
+    r_idx = r_first + p_ordinal;
+    if (r_end - r_first == p_count && r_idx < r_end) {
+        return true;
+    }
+    // the transition is gone, the loop goes on with the one that took its place
+    r_idx = MIN(r_idx, r_end) - 1;
+    return false;
 }
 
-Node *StateMachine::get_context() const {
-    return context;
+bool StateMachine::_fire_baked_transition(uint32_t p_transition, const Ref<StateInput> &p_input) {
+    int32_t target = baked_transition_targets[p_transition];
+    ERR_FAIL_COND_V_MSG(target < 0, false,
+        "Transition target '" + String(baked_transitions[p_transition]->to_state_name) + "' is not in the state machine.");
+
+    return _transition_to_slot(target, p_input);
 }
 
-void StateMachine::set_context(Node *p_context) {
-    if (context == p_context) {
-        return;
-    }
+void StateMachine::_update_processing() {
+    processing_update_queued = false;
 
-    context = p_context;
+    uint8_t needed = 0;
+    if (running && !sleeping && _editor_check()) {
+        _bake();
+        uint32_t active_slot = active_state_idx;
+        bool active_enabled = baked_state_flags[active_slot] & BAKED_STATE_ENABLED;
 
-    emit_signal("context_changed", get_context());
-    for (Ref<State> state : states) {
-        state->emit_changed();
-        TypedArray<StateTransition> transitions = state->get_all_transitions();
-        for (uint64_t idx = 0; idx < transitions.size(); ++idx) {
-            cast_to<StateTransition>(transitions[idx])->emit_changed();
+        for (uint32_t cb = 0; cb < CALLBACK_MAX; ++cb) {
+            uint32_t inactive_count = baked_inactive_counts[cb];
+            if (active_enabled && (baked_inactive_callbacks[active_slot] & CALLBACK_BIT(cb))) {
+                --inactive_count; // the active state receives _active_* instead
+            }
+            if (inactive_count > 0) {
+                needed |= CALLBACK_BIT(cb);
+            }
+            uint32_t range = active_slot * CALLBACK_MAX + cb;
+            if (baked_callback_offsets[range] != baked_callback_offsets[range + 1]) {
+                needed |= CALLBACK_BIT(cb);
+            }
+        }
+        if (active_enabled) {
+            needed |= baked_active_callbacks[active_slot];
         }
+        needed |= baked_any_callbacks;
     }
-}
 
-void StateMachine::set_auto_start(bool p_auto_start) {
-    auto_start = p_auto_start;
-}
+    uint8_t changed = needed ^ processing_callbacks;
+    if (changed == 0) {
+        return;
+    }
+    processing_callbacks = needed;
 
-bool StateMachine::will_auto_start() const {
-    return auto_start;
+    if (changed & CALLBACK_BIT(CALLBACK_PROCESS)) {
+        _set_frame_callback(CALLBACK_PROCESS, needed & CALLBACK_BIT(CALLBACK_PROCESS));
+    }
+    if (changed & CALLBACK_BIT(CALLBACK_PHYSICS_PROCESS)) {
+        _set_frame_callback(CALLBACK_PHYSICS_PROCESS, needed & CALLBACK_BIT(CALLBACK_PHYSICS_PROCESS));
+    }
+    if (changed & CALLBACK_BIT(CALLBACK_INPUT)) {
+        set_process_input(needed & CALLBACK_BIT(CALLBACK_INPUT));
+    }
+    if (changed & CALLBACK_BIT(CALLBACK_SHORTCUT_INPUT)) {
+        set_process_shortcut_input(needed & CALLBACK_BIT(CALLBACK_SHORTCUT_INPUT));
+    }
+    if (changed & CALLBACK_BIT(CALLBACK_UNHANDLED_INPUT)) {
+        set_process_unhandled_input(needed & CALLBACK_BIT(CALLBACK_UNHANDLED_INPUT));
+    }
+    if (changed & CALLBACK_BIT(CALLBACK_UNHANDLED_KEY_INPUT)) {
+        set_process_unhandled_key_input(needed & CALLBACK_BIT(CALLBACK_UNHANDLED_KEY_INPUT));
+    }
 }
 
-void StateMachine::set_run_in_editor(bool p_run_in_editor) {
-    if (p_run_in_editor != run_in_editor) {
-        run_in_editor = p_run_in_editor;
-        if (run_in_editor && auto_start) {
-            callable_mp(this, &StateMachine::_auto_start).call_deferred();
+void StateMachine::_set_frame_callback(StateCallback p_callback, bool p_enabled) {
+    if (!server_driven) {
+        if (p_callback == CALLBACK_PROCESS) {
+            set_process_internal(p_enabled);
+        } else {
+            set_physics_process_internal(p_enabled);
         }
+        return;
     }
-}
 
-bool StateMachine::will_run_in_editor() const {
-    return run_in_editor;
+    StateMachineServer *server = StateMachineServer::get_singleton();
+    ERR_FAIL_NULL(server);
+    if (p_enabled && is_inside_tree()) {
+        server->_add_machine(this, p_callback);
+    } else {
+        server->_remove_machine(this, p_callback);
+    }
 }
 
-bool StateMachine::is_running() const {
-    return running;
+void StateMachine::_frame_tick(StateCallback p_callback, double p_delta) {
+    if (_prepare_tick(p_callback, p_delta)) {
+        _evaluate_tick(p_callback, p_delta);
+    }
 }
 
-void StateMachine::start(StringName p_state, Ref<StateInput> p_input) {
-    if (!_editor_check()) {
-        return;
+// main thread half of a frame tick: decides whether the machine runs this frame and with which delta
+bool StateMachine::_prepare_tick(StateCallback p_callback, double &r_delta) {
+    if (!running) {
+        return false;
     }
 
-    ERR_FAIL_COND_MSG(locked_out, "State machine cannot restart while transition is ongoing.");
-    
-    Ref<State> starting_state = p_state.is_empty() ? get_default_state() : get_state(p_state);
-    ERR_FAIL_NULL_MSG(starting_state, "Invalid starting state, cannot start state machine.");
-
-    if (running) {
-        stop();
+    // requests from other threads are applied before anything else looks at the active state
+    if (transition_queue_pending.load(std::memory_order_acquire)) {
+        _drain_transition_queue();
+        if (!running) {
+            return false;
+        }
     }
 
-    locked_out = true;
-    GDVIRTUAL_CALL(_start, starting_state, p_input);
-    GDVIRTUAL_CALL_PTR(starting_state, _start, p_input);
-    running = true;
-    _activate_state(starting_state, p_input);
-    locked_out = false;
+    if (lod_mode != LOD_DISABLED) {
+        lod_refresh_remaining[p_callback] -= p_delta;
+        if (lod_refresh_remaining[p_callback] <= 0.0) {
+            lod_refresh_remaining[p_callback] = LOD_REFRESH_INTERVAL;
+            lod_tier = _pick_lod_tier();
+        }
 
-    emit_signal("started", starting_state, p_input);
+        if (lod_tier == LOD_TIER_SLEEP) {
+            // time spent asleep is dropped rather than handed over in one huge delta on waking
+            lod_skipped[p_callback] = 0.0;
+            return false;
+        }
+        if (lod_tier == LOD_TIER_REDUCED) {
+            lod_skipped[p_callback] += r_delta;
+            if (lod_skipped[p_callback] < lod_reduced_interval) {
+                return false;
+            }
+            r_delta = lod_skipped[p_callback];
+        }
+        lod_skipped[p_callback] = 0.0;
+    }
 
-    set_process_internal(true);
-    set_physics_process_internal(true);
-    set_process_input(true);
-    set_process_shortcut_input(true);
-    set_process_unhandled_input(true);
-    set_process_unhandled_key_input(true);
+    _bake();
+    return true;
 }
 
-bool StateMachine::transition_to(StringName p_state, Ref<StateInput> p_input) {
-    if (!_editor_check()) {
-        return false;
+// may run on a worker thread when _can_tick_on_thread() allows it
+void StateMachine::_evaluate_tick(StateCallback p_callback, double p_delta) {
+    if (p_callback == CALLBACK_PROCESS) {
+        EVALUATE_STATES(CALLBACK_PROCESS, _process, p_delta, p_delta, transition_delta)
+    } else {
+        EVALUATE_STATES(CALLBACK_PHYSICS_PROCESS, _physics_process, p_delta, p_delta, transition_delta)
     }
+}
 
-    ERR_FAIL_COND_V_MSG(locked_out, false, "State machine will not transition while another transition is ongoing.");
-    ERR_FAIL_COND_V_MSG(!running, false, "State machine must be started before it can transition.");
-
-    Ref<State> next_state = get_state(p_state);
-    ERR_FAIL_NULL_V_MSG(next_state, false, "Invalid state name passed in.");
-    if (!next_state->is_enabled()) {
+bool StateMachine::_can_tick_on_thread(StateCallback p_callback) const {
+    if (!running || graph_dirty) {
+        return false;
+    }
+    uint8_t bit = CALLBACK_BIT(p_callback);
+    if (baked_shared_callbacks & bit) {
+        // thread_safe only vouches for the script, not for two workers running the same instance of it
         return false;
     }
+    return (baked_thread_safe_states & bit) && (baked_thread_safe_any & bit) && (baked_thread_safe_transitions[active_state_idx] & bit);
+}
 
-    Ref<State> cur_state = get_active_state();
-    ERR_FAIL_COND_V_MSG(
-        cur_state.is_valid() && !cur_state->can_transition_to_self() && cur_state == next_state,
-        false, "State requested to transition to itself, but was disallowed from doing so.");
+void StateMachine::_commit_tick() {
+    deferring_transitions = false;
+    if (deferred_transitions.is_empty()) {
+        return;
+    }
 
-    locked_out = true;
-    _ready_transition_input(p_input);
+    LocalVector<uint32_t> candidates;
+    SWAP(candidates, deferred_transitions);
+    // a refused _can_activate falls through to the next candidate, unless it changed the graph or the active state
+    for (uint32_t transition : candidates) {
+        if (!running || !_is_bake_current(deferred_version) || activation_serial != deferred_serial) {
+            break;
+        }
+        if (_fire_baked_transition(transition, baked_transitions[transition]->input)) {
+            break;
+        }
+    }
+}
 
-    bool cont_with_transition = true;
-    GDVIRTUAL_CALL(_transition, next_state, p_input, cont_with_transition);
-    if (!cont_with_transition) { // when machine script virtual method request a transition abort
-        locked_out = false;
+bool StateMachine::_trigger_baked_transition(uint32_t p_transition) {
+    if (deferring_transitions) {
+        // activation runs scripts that may touch the scene tree, so it waits for the main thread.  Whether it
+        // succeeds isn't known yet, so evaluation goes on and lower priority transitions are recorded as well.
+        if (deferred_transitions.is_empty()) {
+            deferred_version = bake_version;
+            deferred_serial = activation_serial;
+        }
+        deferred_transitions.push_back(p_transition);
         return false;
     }
 
-    GDVIRTUAL_CALL_PTR(next_state, _can_activate, p_input, cont_with_transition);
-    if (!cont_with_transition) { // when state virtual method says transition is invalid
-        locked_out = false;
-        return false;
+    return _fire_baked_transition(p_transition, baked_transitions[p_transition]->input);
+}
+
+StateMachine::LodTier StateMachine::_pick_lod_tier() const {
+    if (lod_mode == LOD_VISIBILITY) {
+        // a missing notifier was reported by _check_lod_visibility_notifier(), this runs every refresh
+        Node *notifier = get_node_or_null(lod_visibility_notifier);
+        if (nullptr == notifier) {
+            return LOD_TIER_FULL;
+        }
+        return bool(notifier->call("is_on_screen")) ? LOD_TIER_FULL : lod_offscreen_tier;
     }
 
-    Ref<State> prev_state = cur_state;
-    if (prev_state.is_valid()) {
-        _deactivate_state();
+    Viewport *viewport = get_viewport();
+    if (nullptr == viewport) {
+        return LOD_TIER_FULL;
     }
 
-    _activate_state(next_state, p_input);
-    locked_out = false;
+    double distance_squared = 0.0;
+    if (Node3D *context_3d = Object::cast_to<Node3D>(context)) {
+        Camera3D *camera = viewport->get_camera_3d();
+        if (nullptr == camera) {
+            return LOD_TIER_FULL;
+        }
+        distance_squared = context_3d->get_global_position().distance_squared_to(camera->get_global_position());
+    } else if (Node2D *context_2d = Object::cast_to<Node2D>(context)) {
+        Camera2D *camera = viewport->get_camera_2d();
+        if (nullptr == camera) {
+            return LOD_TIER_FULL;
+        }
+        distance_squared = context_2d->get_global_position().distance_squared_to(camera->get_screen_center_position());
+    } else {
+        return LOD_TIER_FULL;
+    }
 
-    emit_signal("transitioned", prev_state, next_state, p_input);
-    return true;
+    if (lod_sleep_distance > 0.0 && distance_squared >= lod_sleep_distance * lod_sleep_distance) {
+        return LOD_TIER_SLEEP;
+    }
+    if (distance_squared >= lod_reduced_distance * lod_reduced_distance) {
+        return LOD_TIER_REDUCED;
+    }
+    return LOD_TIER_FULL;
 }
 
-void StateMachine::stop() {
-    if (!_editor_check()) {
-        return;
+void StateMachine::_check_lod_visibility_notifier() const {
+    if (lod_mode != LOD_VISIBILITY || !is_node_ready() || !_editor_check()) {
+        return; // checked again once the node is ready, when the path can be resolved
     }
+    if (nullptr == get_node_or_null(lod_visibility_notifier)) {
+        WARN_PRINT("Cannot find the visibility notifier '" + String(lod_visibility_notifier) + "' of '" + String(get_name()) + "', it runs at the full tier.");
+    }
+}
 
-    ERR_FAIL_COND_MSG(locked_out, "State machine cannot be stopped while transition ongoing.");
-    ERR_FAIL_COND_MSG(!running, "State machine must be started before it can stop.");
-
-    locked_out = true;
-    GDVIRTUAL_CALL(_stop);
+int64_t StateMachine::_get_slot(const StringName &p_name) const {
+    const uint32_t *slot = state_index.getptr(p_name);
+    return nullptr == slot ? -1 : int64_t(*slot);
+}
 
-    Ref<State> stopped_state = get_active_state();
-    if (stopped_state.is_valid()) {
-        _deactivate_state();
-        GDVIRTUAL_CALL_PTR(stopped_state, _stop);
+int64_t StateMachine::_get_slot_by_id(int64_t p_id) const {
+    if (p_id < 0 || p_id >= id_slots.size()) {
+        return -1;
     }
 
-    locked_out = false;
-    running = false;
+    return id_slots[p_id];
+}
 
-    emit_signal("stopped", stopped_state);
+void StateMachine::_assign_state_id(State *p_state, uint32_t p_slot) {
+    // keep the saved id when it's free so handles stay stable across save/load, otherwise take the next one
+    int64_t id = p_state->state_id;
+    if (id > _get_max_state_id()) {
+        // the id comes from a file or a script, a corrupt one mustn't size id_slots
+        WARN_PRINT("State '" + String(p_state->get_state_name()) + "' has the out of range id " + itos(id) + ", assigning it a new one.");
+        id = -1;
+    }
+    if (id < 0 || (id < id_slots.size() && id_slots[id] >= 0)) {
+        id = id_slots.size();
+    }
+    while (id_slots.size() <= id) {
+        id_slots.push_back(-1);
+    }
+    id_slots[id] = p_slot;
+    p_state->state_id = id;
+}
 
-    set_process_internal(false);
-    set_physics_process_internal(false);
-    set_process_input(false);
-    set_process_shortcut_input(false);
-    set_process_unhandled_input(false);
-    set_process_unhandled_key_input(false);
+int64_t StateMachine::_get_max_state_id() const {
+    // ids freed by removed states aren't reused, so saved ids can run past the state count, but not by much
+    return MAX(int64_t(states.size()), int64_t(id_slots.size())) * 2 + STATE_ID_SLACK;
 }
 
-bool StateMachine::_editor_check() const {
-    return run_in_editor || !Engine::get_singleton()->is_editor_hint();
+void StateMachine::_reindex_states(uint32_t p_from_slot) {
+    for (uint32_t slot = p_from_slot; slot < states.size(); ++slot) {
+        if (states[slot].is_valid()) {
+            state_index[states[slot]->get_state_name()] = slot;
+            id_slots[states[slot]->get_state_id()] = slot;
+        }
+    }
 }
 
-void StateMachine::_auto_start() {
-    if (auto_start && !running) { // just in case user called start() in _ready()
-        start();
+void StateMachine::_state_renamed(State *p_state, const StringName &p_old_name) {
+    int64_t slot = _get_slot(p_old_name);
+    ERR_FAIL_COND(slot < 0);
+    if (states[slot].ptr() != p_state) {
+        // a graph template renamed while this machine runs its own copy of it
+        ERR_FAIL_COND(_get_template(states[slot].ptr()) != p_state);
+        states[slot]->state_name = p_state->get_state_name();
+    }
+
+    const StringName &new_name = p_state->get_state_name();
+    state_index.erase(p_old_name);
+    state_index.insert(new_name, slot);
+
+    if (default_state_name == p_old_name) {
+        default_state_name = new_name;
+    }
+    // transitions are saved by target name, so keep every edge into this state and every exclusion of it pointing at it
+    for (const Ref<State> &state : states) {
+        for (const Ref<StateTransition> &transition : state->transitions) {
+            _retarget_transition(transition.ptr(), p_state, p_old_name);
+        }
+    }
+    for (const KeyValue<const State *, Ref<State>> &E : state_copies) {
+        for (const Ref<StateTransition> &transition : E.key->transitions) {
+            _retarget_transition(transition.ptr(), p_state, p_old_name);
+        }
     }
+    for (const Ref<StateTransition> &transition : any_transitions) {
+        if (transition.is_valid()) {
+            _retarget_transition(transition.ptr(), p_state, p_old_name);
+        }
+    }
+    // published last, the other instances of a shared graph index states by name too
+    _graph_changed();
 }
 
-void StateMachine::_ready_transition_input(Ref<StateInput> p_input) {
-    if (p_input.is_null()) {
-        p_input.instantiate();
+void StateMachine::_retarget_transition(StateTransition *p_transition, const State *p_state, const StringName &p_old_name) {
+    if (p_transition->to_state_name == p_old_name) {
+        p_transition->to_state_name = p_state->get_state_name();
+        p_transition->to_state_id = p_state->get_state_id();
     }
-    Ref<State> active_state = get_active_state();
-    if (active_state.is_valid()) {
-        p_input->previous_state = active_state->get_state_name();
-    } else {
-        p_input->previous_state = StringName();
+
+    PackedStringArray &excluded = p_transition->excluded_states;
+    for (int64_t idx = 0; idx < excluded.size(); ++idx) {
+        if (StringName(excluded[idx]) == p_old_name) {
+            excluded.set(idx, p_state->get_state_name());
+        }
     }
 }
 
-void StateMachine::_activate_state(Ref<State> p_state, Ref<StateInput> p_input) {
-    ERR_FAIL_NULL(p_state);   
-    ERR_FAIL_COND(!states.has(p_state));
+int64_t StateMachine::_get_target_slot(const StateTransition *p_transition) const {
+    // the cached id is trusted as long as it still leads to a state with the saved name
+    int64_t slot = _get_slot_by_id(p_transition->to_state_id);
+    if (slot >= 0 && states[slot]->get_state_name() == p_transition->to_state_name) {
+        return slot;
+    }
 
-    GDVIRTUAL_CALL_PTR(p_state, _activate, p_input);
-    active_state_idx = states.find(p_state);
+    slot = _get_slot(p_transition->to_state_name);
+    const_cast<StateTransition *>(p_transition)->to_state_id = slot < 0 ? -1 : states[slot]->get_state_id();
+    return slot;
 }
 
-void StateMachine::_deactivate_state() {
-    Ref<State> prev_state = get_active_state();
-    ERR_FAIL_NULL(prev_state);
+bool StateMachine::_request_transition(StateTransition *p_transition) {
+    if (!_editor_check()) {
+        return false;
+    }
 
-    GDVIRTUAL_CALL_PTR(prev_state, _deactivate);
-    prev_state.unref();
+    return _fire_transition(p_transition);
+}
+
+bool StateMachine::_fire_transition(StateTransition *p_transition) {
+    int64_t slot = _get_target_slot(p_transition);
+    ERR_FAIL_COND_V_MSG(slot < 0, false, "Transition target '" + String(p_transition->to_state_name) + "' is not in the state machine.");
+
+    return _transition_to_slot(slot, p_transition->input);
 }
 
 Ref<State> StateMachine::_get_state(uint64_t p_idx) const {
@@ -428,8 +2545,15 @@ Ref<State> StateMachine::_get_state(uint64_t p_idx) const {
 void StateMachine::_bind_methods() {
     ClassDB::bind_method(D_METHOD("add_state", "name"), &StateMachine::add_state);
     ClassDB::bind_method(D_METHOD("append_state", "state"), &StateMachine::append_state);
+    ClassDB::bind_method(D_METHOD("add_states", "names"), &StateMachine::add_states);
     ClassDB::bind_method(D_METHOD("has_state", "name"), &StateMachine::has_state);
     ClassDB::bind_method(D_METHOD("get_state", "name"), &StateMachine::get_state);
+    ClassDB::bind_method(D_METHOD("get_state_id", "name"), &StateMachine::get_state_id);
+    ClassDB::bind_method(D_METHOD("get_state_by_id", "id"), &StateMachine::get_state_by_id);
+    ClassDB::bind_method(D_METHOD("get_state_ids"), &StateMachine::get_state_ids);
+    ClassDB::bind_method(D_METHOD("save_state_constants", "path"), &StateMachine::save_state_constants);
+    ClassDB::bind_method(D_METHOD("export_graph"), &StateMachine::export_graph);
+    ClassDB::bind_method(D_METHOD("import_graph", "data"), &StateMachine::import_graph);
     ClassDB::bind_method(D_METHOD("get_all_states"), &StateMachine::get_all_states);
     ClassDB::bind_method(D_METHOD("remove_state", "state"), &StateMachine::remove_state);
     ClassDB::bind_method(D_METHOD("increment_state_name", "name"), &StateMachine::increment_state_name);
@@ -440,12 +2564,29 @@ void StateMachine::_bind_methods() {
     ClassDB::bind_method(D_METHOD("get_transitions_from", "state"), &StateMachine::get_transitions_from);
     ClassDB::bind_method(D_METHOD("get_transitions_to", "state"), &StateMachine::get_transitions_to);
     ClassDB::bind_method(D_METHOD("get_transition_between", "from_state", "to_state"), &StateMachine::get_transition_between);
+    ClassDB::bind_method(D_METHOD("add_any_transition", "to"), &StateMachine::add_any_transition);
+    ClassDB::bind_method(D_METHOD("append_any_transition", "transition"), &StateMachine::append_any_transition);
+    ClassDB::bind_method(D_METHOD("remove_any_transition", "transition"), &StateMachine::remove_any_transition);
+    ClassDB::bind_method(D_METHOD("get_any_transitions"), &StateMachine::get_any_transitions);
+    ClassDB::bind_method(D_METHOD("add_transitions", "edges"), &StateMachine::add_transitions);
+    ClassDB::bind_method(D_METHOD("begin_batch"), &StateMachine::begin_batch);
+    ClassDB::bind_method(D_METHOD("end_batch"), &StateMachine::end_batch);
+    ClassDB::bind_method(D_METHOD("is_batching"), &StateMachine::is_batching);
     ClassDB::bind_method(D_METHOD("get_all_transitions"), &StateMachine::get_all_transitions);
 
     ClassDB::bind_method(D_METHOD("is_running"), &StateMachine::is_running);
     ClassDB::bind_method(D_METHOD("start", "state", "state_input"), &StateMachine::start, DEFVAL(""), DEFVAL(Ref<StateInput>()));
     ClassDB::bind_method(D_METHOD("transition_to", "state", "state_input"), &StateMachine::transition_to, DEFVAL(Ref<StateInput>()));
+    ClassDB::bind_method(D_METHOD("transition_to_id", "id", "state_input"), &StateMachine::transition_to_id, DEFVAL(Ref<StateInput>()));
+    ClassDB::bind_method(D_METHOD("send_event", "event", "state_input"), &StateMachine::send_event, DEFVAL(Ref<StateInput>()));
     ClassDB::bind_method(D_METHOD("stop"), &StateMachine::stop);
+    ClassDB::bind_method(D_METHOD("queue_transition", "state", "state_input"), &StateMachine::queue_transition, DEFVAL(Ref<StateInput>()));
+    ClassDB::bind_method(D_METHOD("sleep"), &StateMachine::sleep);
+    ClassDB::bind_method(D_METHOD("wake"), &StateMachine::wake);
+    ClassDB::bind_method(D_METHOD("is_sleeping"), &StateMachine::is_sleeping);
+
+    MethodInfo transition_signal_info("_on_transition_signal");
+    ClassDB::bind_vararg_method(METHOD_FLAGS_DEFAULT, "_on_transition_signal", &StateMachine::_on_transition_signal, transition_signal_info);
 
     GDVIRTUAL_BIND(_start, "state", "state_input");
     GDVIRTUAL_BIND(_transition, "state", "state_input");
@@ -460,16 +2601,75 @@ void StateMachine::_bind_methods() {
     ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "default_state", PROPERTY_HINT_RESOURCE_TYPE, "State", PROPERTY_USAGE_NONE), "set_default_state", "get_default_state");
 
     ClassDB::bind_method(D_METHOD("get_active_state"), &StateMachine::get_active_state);
+    ClassDB::bind_method(D_METHOD("get_active_state_id"), &StateMachine::get_active_state_id);
     ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "active_state", PROPERTY_HINT_RESOURCE_TYPE, "State", PROPERTY_USAGE_NONE), "", "get_active_state");
 
     ClassDB::bind_method(D_METHOD("get_context"), &StateMachine::get_context);
     ClassDB::bind_method(D_METHOD("set_context", "context"), &StateMachine::set_context);
     ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "context", PROPERTY_HINT_NODE_TYPE, "", PROPERTY_USAGE_DEFAULT, "Node"), "set_context", "get_context");
 
+    ClassDB::bind_method(D_METHOD("set_graph", "graph"), &StateMachine::set_graph);
+    ClassDB::bind_method(D_METHOD("get_graph"), &StateMachine::get_graph);
+    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "graph", PROPERTY_HINT_RESOURCE_TYPE, "StateMachineGraph"), "set_graph", "get_graph");
+
+    ClassDB::bind_method(D_METHOD("set_per_instance_states", "per_instance"), &StateMachine::set_per_instance_states);
+    ClassDB::bind_method(D_METHOD("has_per_instance_states"), &StateMachine::has_per_instance_states);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "per_instance_states"), "set_per_instance_states", "has_per_instance_states");
+
     ClassDB::bind_method(D_METHOD("set_run_in_editor", "run_in_editor"), &StateMachine::set_run_in_editor);
     ClassDB::bind_method(D_METHOD("will_run_in_editor"), &StateMachine::will_run_in_editor);
     ADD_PROPERTY(PropertyInfo(Variant::BOOL, "run_in_editor"), "set_run_in_editor", "will_run_in_editor");
 
+    ClassDB::bind_method(D_METHOD("set_stagger_evaluation", "stagger"), &StateMachine::set_stagger_evaluation);
+    ClassDB::bind_method(D_METHOD("is_staggering_evaluation"), &StateMachine::is_staggering_evaluation);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "stagger_evaluation"), "set_stagger_evaluation", "is_staggering_evaluation");
+
+    ClassDB::bind_method(D_METHOD("set_max_transitions_per_tick", "max"), &StateMachine::set_max_transitions_per_tick);
+    ClassDB::bind_method(D_METHOD("get_max_transitions_per_tick"), &StateMachine::get_max_transitions_per_tick);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_transitions_per_tick", PROPERTY_HINT_RANGE, "1,16,1,or_greater"), "set_max_transitions_per_tick", "get_max_transitions_per_tick");
+
+    ClassDB::bind_method(D_METHOD("set_max_chain_depth", "depth"), &StateMachine::set_max_chain_depth);
+    ClassDB::bind_method(D_METHOD("get_max_chain_depth"), &StateMachine::get_max_chain_depth);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_chain_depth", PROPERTY_HINT_RANGE, "0,64,1,or_greater"), "set_max_chain_depth", "get_max_chain_depth");
+
+    ClassDB::bind_method(D_METHOD("set_transition_queue_capacity", "capacity"), &StateMachine::set_transition_queue_capacity);
+    ClassDB::bind_method(D_METHOD("get_transition_queue_capacity"), &StateMachine::get_transition_queue_capacity);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "transition_queue_capacity", PROPERTY_HINT_RANGE, "1,1024,1,or_greater"), "set_transition_queue_capacity", "get_transition_queue_capacity");
+
+    ClassDB::bind_method(D_METHOD("set_server_driven", "server_driven"), &StateMachine::set_server_driven);
+    ClassDB::bind_method(D_METHOD("is_server_driven"), &StateMachine::is_server_driven);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "server_driven"), "set_server_driven", "is_server_driven");
+
+    ClassDB::bind_method(D_METHOD("set_lod_mode", "mode"), &StateMachine::set_lod_mode);
+    ClassDB::bind_method(D_METHOD("get_lod_mode"), &StateMachine::get_lod_mode);
+    ClassDB::bind_method(D_METHOD("set_lod_reduced_distance", "distance"), &StateMachine::set_lod_reduced_distance);
+    ClassDB::bind_method(D_METHOD("get_lod_reduced_distance"), &StateMachine::get_lod_reduced_distance);
+    ClassDB::bind_method(D_METHOD("set_lod_sleep_distance", "distance"), &StateMachine::set_lod_sleep_distance);
+    ClassDB::bind_method(D_METHOD("get_lod_sleep_distance"), &StateMachine::get_lod_sleep_distance);
+    ClassDB::bind_method(D_METHOD("set_lod_visibility_notifier", "path"), &StateMachine::set_lod_visibility_notifier);
+    ClassDB::bind_method(D_METHOD("get_lod_visibility_notifier"), &StateMachine::get_lod_visibility_notifier);
+    ClassDB::bind_method(D_METHOD("set_lod_offscreen_tier", "tier"), &StateMachine::set_lod_offscreen_tier);
+    ClassDB::bind_method(D_METHOD("get_lod_offscreen_tier"), &StateMachine::get_lod_offscreen_tier);
+    ClassDB::bind_method(D_METHOD("set_lod_reduced_interval", "interval"), &StateMachine::set_lod_reduced_interval);
+    ClassDB::bind_method(D_METHOD("get_lod_reduced_interval"), &StateMachine::get_lod_reduced_interval);
+    ClassDB::bind_method(D_METHOD("get_lod_tier"), &StateMachine::get_lod_tier);
+
+    ADD_GROUP("Level of Detail", "lod_");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_mode", PROPERTY_HINT_ENUM, "Disabled,Distance,Visibility"), "set_lod_mode", "get_lod_mode");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_reduced_distance", PROPERTY_HINT_RANGE, "0,1000,0.1,or_greater"), "set_lod_reduced_distance", "get_lod_reduced_distance");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_sleep_distance", PROPERTY_HINT_RANGE, "0,1000,0.1,or_greater"), "set_lod_sleep_distance", "get_lod_sleep_distance");
+    ADD_PROPERTY(PropertyInfo(Variant::NODE_PATH, "lod_visibility_notifier", PROPERTY_HINT_NODE_PATH_VALID_TYPES, "VisibleOnScreenNotifier2D,VisibleOnScreenNotifier3D"), "set_lod_visibility_notifier", "get_lod_visibility_notifier");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_offscreen_tier", PROPERTY_HINT_ENUM, "Full,Reduced,Sleep"), "set_lod_offscreen_tier", "get_lod_offscreen_tier");
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_reduced_interval", PROPERTY_HINT_RANGE, "0,2,0.01,or_greater,suffix:s"), "set_lod_reduced_interval", "get_lod_reduced_interval");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_tier", PROPERTY_HINT_ENUM, "Full,Reduced,Sleep", PROPERTY_USAGE_NONE), "", "get_lod_tier");
+
+    BIND_ENUM_CONSTANT(LOD_DISABLED);
+    BIND_ENUM_CONSTANT(LOD_DISTANCE);
+    BIND_ENUM_CONSTANT(LOD_VISIBILITY);
+    BIND_ENUM_CONSTANT(LOD_TIER_FULL);
+    BIND_ENUM_CONSTANT(LOD_TIER_REDUCED);
+    BIND_ENUM_CONSTANT(LOD_TIER_SLEEP);
+
     ADD_SIGNAL(MethodInfo("state_added",
         PropertyInfo(Variant::OBJECT, "state", PROPERTY_HINT_RESOURCE_TYPE, "State")));
     ADD_SIGNAL(MethodInfo("state_removed",
@@ -491,14 +2691,23 @@ void StateMachine::_bind_methods() {
 }
 
 void StateMachine::_get_property_list(List<PropertyInfo> *p_list) const {
+    if (graph.is_valid()) {
+        return; // the topology is saved with the graph, once for every instance
+    }
+
     p_list->push_back(PropertyInfo(
         Variant::STRING_NAME, "default_state_name",
         PROPERTY_HINT_ENUM_SUGGESTION, String(",").join(get_all_state_names()), PROPERTY_USAGE_DEFAULT | PROPERTY_USAGE_INTERNAL));
-    for (uint64_t idx = 0; idx < states.size(); ++idx) {
-        p_list->push_back(PropertyInfo(
-            Variant::OBJECT, "states/" + itos(idx), 
-            PROPERTY_HINT_RESOURCE_TYPE, "State", PROPERTY_USAGE_DEFAULT | PROPERTY_USAGE_INTERNAL | PROPERTY_USAGE_ALWAYS_DUPLICATE));
-    }
+    // states are saved as one array plus the target slot of every transition, so loading is a single pass.
+    // Older files list each one as states/N and any_transitions/N, which _set() still accepts.
+    p_list->push_back(PropertyInfo(
+        Variant::ARRAY, "_states",
+        PROPERTY_HINT_ARRAY_TYPE, "State", PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL | PROPERTY_USAGE_ALWAYS_DUPLICATE));
+    p_list->push_back(PropertyInfo(
+        Variant::PACKED_INT32_ARRAY, "_edges", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL));
+    p_list->push_back(PropertyInfo(
+        Variant::ARRAY, "_any_transitions",
+        PROPERTY_HINT_ARRAY_TYPE, "StateTransition", PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL | PROPERTY_USAGE_ALWAYS_DUPLICATE));
 }
 
 bool StateMachine::_property_can_revert(const StringName &p_name) const {
@@ -527,6 +2736,55 @@ bool StateMachine::_set(const StringName &p_name, const Variant &p_value) {
     if (p_name == StringName("default_state_name")) {
         default_state_name = p_value;
         return true;
+    } else if (p_name == StringName("_states")) {
+        Array in = p_value;
+        for (const Ref<State> &state : states) {
+            if (state.is_valid()) {
+                _claim_state(state.ptr(), false);
+            }
+        }
+        states.resize(in.size());
+        state_index.clear();
+        state_index.reserve(in.size());
+        id_slots.clear();
+        Ref<State> *out = states.ptrw();
+        for (int64_t idx = 0; idx < in.size(); ++idx) {
+            out[idx] = in[idx];
+            if (out[idx].is_valid() && out[idx]->_has_owner()) {
+                // Node::duplicate() copies the array but not the states in it, they still belong to the original
+                out[idx] = out[idx]->duplicate(true);
+            }
+            if (out[idx].is_valid()) {
+                state_index.insert(out[idx]->get_state_name(), idx);
+                _assign_state_id(out[idx].ptr(), idx);
+                _claim_state(out[idx].ptr(), true);
+            }
+        }
+        _graph_changed();
+        return true;
+    } else if (p_name == StringName("_edges")) {
+        StateMachineGraph::_unpack_edges(states, p_value);
+        return true;
+    } else if (p_name == StringName("_any_transitions")) {
+        Array in = p_value;
+        for (const Ref<StateTransition> &transition : any_transitions) {
+            if (transition.is_valid()) {
+                _claim_any_transition(transition.ptr(), false);
+            }
+        }
+        any_transitions.resize(in.size());
+        Ref<StateTransition> *out = any_transitions.ptrw();
+        for (int64_t idx = 0; idx < in.size(); ++idx) {
+            out[idx] = in[idx];
+            if (out[idx].is_valid() && out[idx]->_has_owner()) {
+                out[idx] = out[idx]->_duplicate_for(nullptr);
+            }
+            if (out[idx].is_valid()) {
+                _claim_any_transition(out[idx].ptr(), true);
+            }
+        }
+        _graph_changed();
+        return true;
     } else if (p_name.begins_with("states/")) {
         Ref<State> state = p_value;
         if (state.is_null()) {
@@ -536,8 +2794,38 @@ bool StateMachine::_set(const StringName &p_name, const Variant &p_value) {
         if (idx >= states.size()) {
             states.resize(idx + 1);
         }
+        if (states[idx].is_valid()) {
+            state_index.erase(states[idx]->get_state_name());
+            id_slots[states[idx]->get_state_id()] = -1;
+            _claim_state(states[idx].ptr(), false);
+        }
+        if (state->_has_owner()) {
+            state = state->duplicate(true);
+        }
         states.set(idx, state);
-        state->_set_state_machine(this);
+        state_index.insert(state->get_state_name(), idx);
+        _assign_state_id(state.ptr(), idx);
+        _claim_state(state.ptr(), true);
+        _graph_changed();
+        return true;
+    } else if (p_name.begins_with("any_transitions/")) {
+        Ref<StateTransition> transition = p_value;
+        if (transition.is_null()) {
+            return false;
+        }
+        int idx = p_name.get_slice("/", 1).to_int();
+        if (idx >= any_transitions.size()) {
+            any_transitions.resize(idx + 1);
+        }
+        if (any_transitions[idx].is_valid()) {
+            _claim_any_transition(any_transitions[idx].ptr(), false);
+        }
+        if (transition->_has_owner()) {
+            transition = transition->_duplicate_for(nullptr);
+        }
+        any_transitions.set(idx, transition);
+        _claim_any_transition(transition.ptr(), true);
+        _graph_changed();
         return true;
     }
 
@@ -548,10 +2836,28 @@ bool StateMachine::_get(const StringName &p_name, Variant &r_ret) const {
     if (p_name == StringName("default_state_name")) {
         r_ret = default_state_name;
         return true;
+    } else if (p_name == StringName("_states")) {
+        TypedArray<State> out;
+        out.resize(states.size());
+        for (int64_t idx = 0; idx < states.size(); ++idx) {
+            out[idx] = states[idx];
+        }
+        r_ret = out;
+        return true;
+    } else if (p_name == StringName("_edges")) {
+        r_ret = StateMachineGraph::_pack_edges(states);
+        return true;
+    } else if (p_name == StringName("_any_transitions")) {
+        r_ret = get_any_transitions();
+        return true;
     } else if (p_name.begins_with("states/")) {
         uint64_t idx = p_name.get_slice("/", 1).to_int();
         r_ret = _get_state(idx);
         return true;
+    } else if (p_name.begins_with("any_transitions/")) {
+        int64_t idx = p_name.get_slice("/", 1).to_int();
+        r_ret = idx < any_transitions.size() ? any_transitions[idx] : Ref<StateTransition>();
+        return true;
     }
 
     return false;
@@ -573,22 +2879,42 @@ PackedStringArray StateMachine::_get_configuration_warnings() const {
 void StateMachine::_notification(int p_what) {
     switch (p_what) {
         case NOTIFICATION_READY: {
+            // the engine turns on input processing for every overridden input virtual when the node becomes ready
+            processing_callbacks = CALLBACK_BIT(CALLBACK_MAX) - 1;
+            _update_processing();
+            _check_lod_visibility_notifier();
             if (_editor_check() && auto_start && !running) {
                 callable_mp(this, &StateMachine::_auto_start).call_deferred();
             }
         } break;
 
+        case NOTIFICATION_ENTER_TREE: {
+            if (server_driven) {
+                for (StateCallback cb : { CALLBACK_PROCESS, CALLBACK_PHYSICS_PROCESS }) {
+                    if (processing_callbacks & CALLBACK_BIT(cb)) {
+                        _set_frame_callback(cb, true);
+                    }
+                }
+            }
+        } break;
+
+        case NOTIFICATION_EXIT_TREE: {
+            // the server only ticks machines inside the tree, same as the engine's own processing
+            if (server_driven) {
+                _set_frame_callback(CALLBACK_PROCESS, false);
+                _set_frame_callback(CALLBACK_PHYSICS_PROCESS, false);
+            }
+        } break;
+
         case NOTIFICATION_INTERNAL_PROCESS: {
-            if (_editor_check() && running) {
-                double delta = get_process_delta_time();
-                EVALUATE_STATES(_process, delta)
+            if (_editor_check()) {
+                _frame_tick(CALLBACK_PROCESS, get_process_delta_time());
             }
         } break;
 
         case NOTIFICATION_INTERNAL_PHYSICS_PROCESS: {
-            if (_editor_check() && running) {
-                double delta = get_physics_process_delta_time();
-                EVALUATE_STATES(_physics_process, delta)
+            if (_editor_check()) {
+                _frame_tick(CALLBACK_PHYSICS_PROCESS, get_physics_process_delta_time());
             }
         } break;
     }
@@ -596,25 +2922,25 @@ void StateMachine::_notification(int p_what) {
 
 void StateMachine::_input(const Ref<InputEvent> &p_event) {
     if (_editor_check() && running) {
-        EVALUATE_STATES(_input, p_event)
+        EVALUATE_STATES(CALLBACK_INPUT, _input, p_event, 0.0, p_event)
     }
 }
 
 void StateMachine::_shortcut_input(const Ref<InputEvent> &p_event) {
     if (_editor_check() && running) {
-        EVALUATE_STATES(_shortcut_input, p_event)
+        EVALUATE_STATES(CALLBACK_SHORTCUT_INPUT, _shortcut_input, p_event, 0.0, p_event)
     }
 }
 
 void StateMachine::_unhandled_input(const Ref<InputEvent> &p_event) {
     if (_editor_check() && running) {
-        EVALUATE_STATES(_unhandled_input, p_event)
+        EVALUATE_STATES(CALLBACK_UNHANDLED_INPUT, _unhandled_input, p_event, 0.0, p_event)
     }
 }
 
 void StateMachine::_unhandled_key_input(const Ref<InputEvent> &p_event) {
     if (_editor_check() && running) {
-        EVALUATE_STATES(_unhandled_key_input, p_event)
+        EVALUATE_STATES(CALLBACK_UNHANDLED_KEY_INPUT, _unhandled_key_input, p_event, 0.0, p_event)
     }
 }
 
@@ -625,9 +2951,29 @@ StateMachine::~StateMachine() {
     if (running) {
         stop();
     }
+    _discard_timers();
 
-    for (const Ref<State> &state : states) {
-        state->_set_state_machine(nullptr);
+    StateMachineServer *server = StateMachineServer::get_singleton();
+    if (nullptr != server) {
+        server->_remove_machine(this, CALLBACK_PROCESS);
+        server->_remove_machine(this, CALLBACK_PHYSICS_PROCESS);
+    }
+
+    if (graph.is_valid()) {
+        graph->_detach(this); // the states stay with the graph
+        _drop_state_copies();
+    } else {
+        for (const Ref<State> &state : states) {
+            _claim_state(state.ptr(), false);
+        }
+        for (const Ref<StateTransition> &transition : any_transitions) {
+            if (transition.is_valid()) {
+                _claim_any_transition(transition.ptr(), false);
+            }
+        }
     }
     states.clear();
+    any_transitions.clear();
+    state_index.clear();
+    id_slots.clear();
 }
\ No newline at end of file
@@ -3,9 +3,15 @@
 
 #include <godot_cpp/core/binder_common.hpp>
 #include <godot_cpp/core/gdvirtual.gen.inc>
+#include <godot_cpp/templates/hash_map.hpp>
 #include <godot_cpp/templates/hash_set.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
 #include <godot_cpp/classes/node.hpp>
+#include "mpsc_queue.hpp"
 #include "state.hpp"
+#include "state_callbacks.hpp"
+#include "state_input.hpp"
+#include "state_machine_graph.hpp"
 
 namespace godot::ez_fsm {
 
@@ -15,7 +21,25 @@ class StateTransition;
 class StateMachine : public Node {
     GDCLASS(StateMachine, Node)
 
+friend class State;
+friend class StateTransition;
+friend class StateMachineGraph;
+friend class TransitionTimers;
+friend class StateMachineServer;
+
 public:
+    enum LodMode {
+        LOD_DISABLED,
+        LOD_DISTANCE,
+        LOD_VISIBILITY,
+    };
+
+    enum LodTier {
+        LOD_TIER_FULL,
+        LOD_TIER_REDUCED,
+        LOD_TIER_SLEEP,
+    };
+
     void set_auto_start(bool p_auto_start);
     bool will_auto_start() const;
     bool is_running() const;
@@ -23,13 +47,61 @@ public:
     Node *get_context() const;
     void set_context(Node *p_context);
 
+    void set_graph(const Ref<StateMachineGraph> &p_graph);
+    Ref<StateMachineGraph> get_graph() const;
+
+    void set_per_instance_states(bool p_per_instance);
+    bool has_per_instance_states() const;
+
     void set_run_in_editor(bool p_run_in_editor);
     bool will_run_in_editor() const;
 
+    void set_max_transitions_per_tick(int64_t p_max);
+    int64_t get_max_transitions_per_tick() const;
+
+    void set_max_chain_depth(int64_t p_depth);
+    int64_t get_max_chain_depth() const;
+
+    void set_transition_queue_capacity(int64_t p_capacity);
+    int64_t get_transition_queue_capacity() const;
+
+    void set_server_driven(bool p_server_driven);
+    bool is_server_driven() const;
+
+    void set_stagger_evaluation(bool p_stagger);
+    bool is_staggering_evaluation() const;
+
+    void set_lod_mode(LodMode p_mode);
+    LodMode get_lod_mode() const;
+
+    void set_lod_reduced_distance(double p_distance);
+    double get_lod_reduced_distance() const;
+
+    void set_lod_sleep_distance(double p_distance);
+    double get_lod_sleep_distance() const;
+
+    void set_lod_visibility_notifier(const NodePath &p_path);
+    NodePath get_lod_visibility_notifier() const;
+
+    void set_lod_offscreen_tier(LodTier p_tier);
+    LodTier get_lod_offscreen_tier() const;
+
+    void set_lod_reduced_interval(double p_interval);
+    double get_lod_reduced_interval() const;
+
+    LodTier get_lod_tier() const;
+
     Ref<State> add_state(const StringName &p_name);
     void append_state(const Ref<State> &p_state);
+    TypedArray<State> add_states(const PackedStringArray &p_names);
     bool has_state(const StringName &p_state) const;
     Ref<State> get_state(const StringName &p_state) const;
+    int64_t get_state_id(const StringName &p_state) const;
+    Ref<State> get_state_by_id(int64_t p_id) const;
+    Dictionary get_state_ids() const;
+    Error save_state_constants(const String &p_path) const;
+    PackedByteArray export_graph() const;
+    Error import_graph(const PackedByteArray &p_data);
     TypedArray<State> get_all_states() const;
     void remove_state(Ref<State> p_state);
     StringName increment_state_name(const StringName &p_name) const;
@@ -39,6 +111,7 @@ public:
     Ref<State> get_default_state() const;
 
     Ref<State> get_active_state() const;
+    int64_t get_active_state_id() const;
 
     Ref<StateTransition> add_transition_between(const Ref<State> &p_from, const Ref<State> &p_to);
     TypedArray<StateTransition> get_transitions_from(const Ref<State> &p_from) const;
@@ -46,9 +119,27 @@ public:
     Ref<StateTransition> get_transition_between(const Ref<State> &p_from, const Ref<State> &p_to) const;
     TypedArray<StateTransition> get_all_transitions() const;
     void remove_transition(Ref<StateTransition> p_transition);
+    TypedArray<StateTransition> add_transitions(const PackedInt32Array &p_edges);
+
+    void begin_batch();
+    void end_batch();
+    bool is_batching() const;
+
+    Ref<StateTransition> add_any_transition(const Ref<State> &p_to);
+    void append_any_transition(const Ref<StateTransition> &p_transition);
+    void remove_any_transition(const Ref<StateTransition> &p_transition);
+    TypedArray<StateTransition> get_any_transitions() const;
 
     void start(StringName p_state = StringName(), Ref<StateInput> p_input = Ref<StateInput>());
     bool transition_to(StringName p_state, Ref<StateInput> p_input = Ref<StateInput>());
+    bool transition_to_id(int64_t p_id, Ref<StateInput> p_input = Ref<StateInput>());
+    bool queue_transition(const Variant &p_state, const Ref<StateInput> &p_input = Ref<StateInput>());
+
+    void sleep();
+    void wake();
+    bool is_sleeping() const;
+
+    bool send_event(const StringName &p_event, const Ref<StateInput> &p_input = Ref<StateInput>());
     void stop();
 
     virtual PackedStringArray _get_configuration_warnings() const override;
@@ -77,23 +168,244 @@ private:
     bool auto_start = true;
     bool running = false;
     bool locked_out = false;
+    bool sleeping = false; // keeps the active state but receives no process or input callbacks
     bool run_in_editor = false;
+    bool stagger_evaluation = false;
+    bool server_driven = false;
+    // position in StateMachineServer's process and physics lists, -1 when not registered
+    int32_t server_indices[2] = { -1, -1 };
+    // server clock at the last process and physics tick, so deferred machines get the time they missed
+    double server_tick_times[2] = { 0.0, 0.0 };
+
+    LodMode lod_mode = LOD_DISABLED;
+    double lod_reduced_distance = 30.0;
+    double lod_sleep_distance = 100.0;
+    NodePath lod_visibility_notifier;
+    LodTier lod_offscreen_tier = LOD_TIER_REDUCED;
+    double lod_reduced_interval = 0.2;
+    LodTier lod_tier = LOD_TIER_FULL;
+    // per frame callback: time until the tier is picked again, and time skipped since the last reduced tick
+    double lod_refresh_remaining[2] = { 0.0, 0.0 };
+    double lod_skipped[2] = { 0.0, 0.0 };
 
     Vector<Ref<State>> states;
+    Vector<Ref<StateTransition>> any_transitions; // checked from every state, ahead of the active state's own
+    HashMap<StringName, uint32_t> state_index; // state name -> slot in states
+    LocalVector<int32_t> id_slots; // state id -> slot in states, -1 when the id is unused
     StringName default_state_name;
-    uint64_t active_state_idx;
+    uint64_t active_state_idx = 0;
+    uint32_t activation_serial = 0; // bumped on every activation to invalidate pending timeouts
+    uint32_t armed_timers = 0; // timeouts this machine has pending in TransitionTimers for the current activation
+    std::atomic<int64_t> active_state_id{ -1 }; // mirrors the active state's id for readers on other threads
+    // shared topology; when set, states and any_transitions are copy on write views of the graph's
+    Ref<StateMachineGraph> graph;
+    bool per_instance_states = false;
+    // graph state -> this machine's own duplicate, made the first time the state is activated or queried
+    HashMap<const State *, Ref<State>> state_copies;
+    // State.enabled set on a graph state from this machine's callbacks, which must not disable it for every machine
+    HashMap<const State *, bool> enabled_overrides;
+
+    // machine whose callbacks are running on this thread, so states shared through a graph can find it
+    static thread_local StateMachine *current_machine;
+
+    struct CurrentMachineScope {
+        StateMachine *previous = nullptr;
+
+        CurrentMachineScope(StateMachine *p_machine) : previous(current_machine) { current_machine = p_machine; }
+        ~CurrentMachineScope() { current_machine = previous; }
+    };
+
+    // transitions requested while another one was running, applied as soon as it finishes
+    struct ReentrantTransition {
+        int64_t state_id = -1;
+        Ref<StateInput> input;
+    };
+    LocalVector<ReentrantTransition> reentrant_transitions;
+    bool flushing_reentrant = false;
+    int64_t max_chain_depth = 8;
+    int64_t max_transitions_per_tick = 1;
+
+    // transitions requested from any thread through queue_transition(), applied on the main thread
+    struct QueuedTransition {
+        StringName state;
+        int64_t state_id = -1;
+        Ref<StateInput> input;
+    };
+    MPSCQueue<QueuedTransition> transition_queue{ 64 };
+    std::atomic<bool> transition_queue_pending{ false }; // set by the first push after a drain
+    // the cells can only be reallocated before the first post, this settles a resize racing a first post
+    enum TransitionQueueState : uint8_t {
+        TRANSITION_QUEUE_UNUSED,
+        TRANSITION_QUEUE_POSTED,
+        TRANSITION_QUEUE_RESIZING,
+    };
+    std::atomic<uint8_t> transition_queue_state{ TRANSITION_QUEUE_UNUSED };
+
+    // edits made between begin_batch() and end_batch() only touch the data, the updates they owe run once at the end
+    int32_t batch_depth = 0;
+    bool batch_graph_changed = false;
+    LocalVector<Ref<State>> batch_added_states;
+    LocalVector<Ref<State>> batch_removed_states;
+    LocalVector<Ref<State>> batch_changed_states;
 
     Node *context = nullptr;
+    Ref<StateInput> default_input; // handed to transitions requested without an input
+
+    struct BakedEventKey {
+        StringName event;
+        uint32_t slot = 0;
+
+        bool operator==(const BakedEventKey &p_other) const { return slot == p_other.slot && event == p_other.event; }
+    };
+
+    struct BakedEventKeyHasher {
+        static uint32_t hash(const BakedEventKey &p_key) { return hash_murmur3_one_32(p_key.slot, p_key.event.hash()); }
+    };
+
+    struct SignalConnection {
+        uint64_t source_id = 0;
+        StringName signal;
+        Callable callable;
+    };
+    LocalVector<SignalConnection> signal_connections; // signals connected for the active state's transitions
+
+    enum BakedStateFlags : uint8_t {
+        BAKED_STATE_ENABLED = 1 << 0,
+        BAKED_STATE_TRANSITIONS_TO_SELF = 1 << 1,
+        BAKED_STATE_HAS_TIMEOUTS = 1 << 2,
+        BAKED_STATE_HAS_SIGNALS = 1 << 3,
+        BAKED_STATE_SLEEPS_UNTIL_EVENT = 1 << 4,
+    };
+
+    // Flat view of the graph the evaluation loop runs from, rebuilt by _bake() whenever graph_dirty is set.
+    // Per-state arrays are indexed by slot, per-transition arrays by the transition's position in the table.
+    LocalVector<uint8_t> baked_state_flags;
+    LocalVector<uint8_t> baked_active_callbacks;
+    LocalVector<uint8_t> baked_inactive_callbacks;
+    LocalVector<uint32_t> baked_transition_offsets; // slot -> first transition, slot + 1 -> one past the last
+    LocalVector<StateTransition *> baked_transitions; // in priority order, grouped by from state
+    LocalVector<int32_t> baked_transition_targets; // slot of the target state, -1 when unresolved
+    // transitions of each state that override a StateCallback, indexed by slot * CALLBACK_MAX + callback
+    LocalVector<uint32_t> baked_callback_offsets;
+    LocalVector<uint32_t> baked_callback_transitions;
+    // evaluation_interval of each entry in baked_callback_transitions, 0 when it runs every tick
+    LocalVector<double> baked_callback_intervals;
+    LocalVector<uint8_t> baked_callback_interval_frames; // 1 when the interval counts frames instead of seconds
+    // countdown to the next evaluation and time since the last one, for each interval-limited entry
+    LocalVector<double> interval_remaining;
+    LocalVector<double> interval_elapsed;
+    // both of the above for one entry, kept across a rebake keyed by the transition's address and its callback
+    struct IntervalCountdown {
+        double remaining = 0.0;
+        double elapsed = 0.0;
+    };
+    // transitions listening for each event, keyed by the from state's slot and the event name
+    HashMap<BakedEventKey, LocalVector<uint32_t>, BakedEventKeyHasher> baked_event_transitions;
+    // enabled states overriding the _active_* or _inactive_* virtual of each StateCallback, in slot order
+    LocalVector<uint32_t> baked_callback_states[CALLBACK_MAX];
+    // number of enabled states overriding the _inactive_* virtual of each StateCallback
+    uint32_t baked_inactive_counts[CALLBACK_MAX] = {};
+    // StateCallback bits whose subscribed states are all thread safe, and per slot, whose transitions all are
+    uint8_t baked_thread_safe_states = 0;
+    LocalVector<uint8_t> baked_thread_safe_transitions;
+    // StateCallback bits reaching a state or transition shared through the graph, whose script instance other
+    // machines may be running at the same time
+    uint8_t baked_shared_callbacks = 0;
+    // any-state transitions sit at the end of baked_transitions, from baked_any_first on.  Their entries in
+    // baked_callback_transitions are indexed by callback, and baked_any_excluded holds one byte per
+    // (any transition, slot) pair that is set when the transition must not fire from that slot.
+    uint32_t baked_any_first = 0;
+    uint32_t baked_any_callback_offsets[CALLBACK_MAX + 1] = {};
+    LocalVector<uint8_t> baked_any_excluded;
+    uint8_t baked_any_callbacks = 0;
+    uint8_t baked_thread_safe_any = 0;
+    // per slot, the evaluation pass that last visited the state, to detect loops when chaining transitions
+    LocalVector<uint32_t> baked_chain_stamps;
+    uint32_t chain_stamp_counter = 0;
+    bool graph_dirty = true;
+    uint32_t bake_version = 0;
+    // StateCallback bits the engine is currently delivering to this node
+    uint8_t processing_callbacks = 0;
+    bool processing_update_queued = false;
 
     bool _editor_check() const;
     void _auto_start();
     Ref<State> _get_state(uint64_t p_idx) const;
-    void _activate_state(Ref<State> p_state, Ref<StateInput> p_input);
+    int64_t _get_slot(const StringName &p_name) const;
+    int64_t _get_slot_by_id(int64_t p_id) const;
+    void _assign_state_id(State *p_state, uint32_t p_slot);
+    int64_t _get_max_state_id() const;
+    void _reindex_states(uint32_t p_from_slot);
+    void _state_renamed(State *p_state, const StringName &p_old_name);
+    void _retarget_transition(StateTransition *p_transition, const State *p_state, const StringName &p_old_name);
+    int64_t _get_target_slot(const StateTransition *p_transition) const;
+    bool _request_transition(StateTransition *p_transition);
+    bool _fire_transition(StateTransition *p_transition);
+    State *_get_active_state_ptr() const;
+    void _graph_changed();
+    void _mark_graph_dirty();
+    void _pull_graph();
+    void _claim_state(State *p_state, bool p_claim);
+    void _claim_any_transition(StateTransition *p_transition, bool p_claim);
+    bool _owns_state(const State *p_state) const;
+    void _materialize_state(uint32_t p_slot) const;
+    Ref<State> _duplicate_state(const Ref<State> &p_state) const;
+    bool _is_state_enabled(const State *p_state) const;
+    void _override_state_enabled(const State *p_state, bool p_enabled);
+    State *_get_template(const State *p_copy) const;
+    Vector<Ref<State>> _get_graph_states() const;
+    void _drop_state_copies();
+    static StateMachine *_get_current_machine();
+    void _bake();
+    bool _is_bake_current(uint32_t p_version) const;
+    bool _resume_bake(uint32_t &r_version);
+    uint32_t _next_subscribed_state(StateCallback p_callback, uint32_t p_slot) const;
+    bool _resume_callback_loop(int64_t p_slot, StateCallback p_callback, const StateTransition *p_transition, int64_t p_ordinal, int64_t p_count, int64_t &r_first, int64_t &r_idx, int64_t &r_end) const;
+    bool _fire_baked_transition(uint32_t p_transition, const Ref<StateInput> &p_input);
+    void _update_processing();
+    void _set_frame_callback(StateCallback p_callback, bool p_enabled);
+    // set while a worker thread evaluates this machine; every transition that asks to fire is kept in priority order
+    // and _commit_tick() tries them until one activates its target, as the main thread would have
+    bool deferring_transitions = false;
+    LocalVector<uint32_t> deferred_transitions;
+    uint32_t deferred_version = 0;
+    uint32_t deferred_serial = 0;
+
+    void _drain_transition_queue();
+    void _frame_tick(StateCallback p_callback, double p_delta);
+    bool _prepare_tick(StateCallback p_callback, double &r_delta);
+    void _evaluate_tick(StateCallback p_callback, double p_delta);
+    bool _can_tick_on_thread(StateCallback p_callback) const;
+    void _commit_tick();
+    bool _trigger_baked_transition(uint32_t p_transition);
+    LodTier _pick_lod_tier() const;
+    void _check_lod_visibility_notifier() const;
+    bool _transition_to_slot(uint32_t p_slot, const Ref<StateInput> &p_input);
+    bool _run_transition(uint32_t p_slot, const Ref<StateInput> &p_input);
+    void _flush_reentrant_transitions();
+    void _activate_state(uint32_t p_slot, const Ref<StateInput> &p_input);
     void _deactivate_state();
+    void _arm_timeouts(uint32_t p_slot);
+    void _discard_timers();
+    bool _timer_expired(uint32_t p_serial, uint64_t p_transition_id);
+    void _reset_intervals(uint32_t p_slot);
+    void _reset_any_intervals();
+    void _reset_interval_range(uint32_t p_first, uint32_t p_end);
+    void _save_interval_countdowns(HashMap<uint64_t, IntervalCountdown> &r_countdowns) const;
+    void _restore_interval_countdowns(const HashMap<uint64_t, IntervalCountdown> &p_countdowns);
+    bool _is_any_excluded(uint32_t p_transition, uint32_t p_slot) const;
+    bool _advance_interval(uint32_t p_entry, double p_delta, double &r_delta);
+    void _connect_signals(uint32_t p_slot);
+    void _disconnect_signals();
+    Variant _on_transition_signal(const Variant **p_args, GDExtensionInt p_argc, GDExtensionCallError &r_error);
+    bool _fire_active_transition(uint64_t p_transition_id);
 
-    void _ready_transition_input(Ref<StateInput> p_input);
+    const Ref<StateInput> &_ready_transition_input(const Ref<StateInput> &p_input);
 };
 
 }
 
+VARIANT_ENUM_CAST(ez_fsm::StateMachine::LodMode);
+VARIANT_ENUM_CAST(ez_fsm::StateMachine::LodTier);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include "state_machine_graph.hpp"
+#include "state.hpp"
+#include "state_machine.hpp"
+#include "state_transition.hpp"
+
+using namespace godot;
+using namespace godot::ez_fsm;
+
+TypedArray<State> StateMachineGraph::get_all_states() const {
+    TypedArray<State> out;
+    for (const Ref<State> &state : states) {
+        out.push_back(state);
+    }
+    return out;
+}
+
+TypedArray<StateTransition> StateMachineGraph::get_any_transitions() const {
+    TypedArray<StateTransition> out;
+    for (const Ref<StateTransition> &transition : any_transitions) {
+        if (transition.is_valid()) {
+            out.push_back(transition);
+        }
+    }
+    return out;
+}
+
+StringName StateMachineGraph::get_default_state_name() const {
+    return default_state_name;
+}
+
+int64_t StateMachineGraph::get_instance_count() const {
+    return machines.size();
+}
+
+void StateMachineGraph::_attach(StateMachine *p_machine) {
+    ERR_FAIL_COND(machines.has(p_machine));
+    machines.push_back(p_machine);
+}
+
+void StateMachineGraph::_detach(StateMachine *p_machine) {
+    machines.erase(p_machine);
+}
+
+StateMachine *StateMachineGraph::_get_machine() const {
+    // the machine running a callback of this graph, outside of one every user of the graph is as good as another
+    StateMachine *current = StateMachine::_get_current_machine();
+    return nullptr != current && current->graph.ptr() == this ? current : nullptr;
+}
+
+StateMachine *StateMachineGraph::_get_any_machine() const {
+    // for edits and name lookups, which every machine using the graph answers alike
+    StateMachine *current = _get_machine();
+    if (nullptr != current) {
+        return current;
+    }
+
+    return machines.is_empty() ? nullptr : machines[0];
+}
+
+void StateMachineGraph::_publish(StateMachine *p_source) {
+    if (nullptr != p_source) {
+        // Vector is copy on write, so every machine ends up reading the same buffers again
+        states = p_source->_get_graph_states();
+        any_transitions = p_source->any_transitions;
+        default_state_name = p_source->default_state_name;
+    }
+
+    for (StateMachine *machine : machines) {
+        if (machine != p_source) {
+            machine->_pull_graph();
+        }
+    }
+    emit_changed();
+}
+
+void StateMachineGraph::_graph_changed() {
+    // a shared state or transition was edited in place, every machine already holds it and only has to rebake;
+    // edits to the topology itself go through a machine, which publishes them
+    for (StateMachine *machine : machines) {
+        machine->_mark_graph_dirty();
+    }
+    emit_changed();
+}
+
+PackedInt32Array StateMachineGraph::_pack_edges(const Vector<Ref<State>> &p_states) {
+    HashMap<StringName, int32_t> slots;
+    int64_t edge_count = 0;
+    for (int64_t slot = 0; slot < p_states.size(); ++slot) {
+        if (p_states[slot].is_valid()) {
+            slots.insert(p_states[slot]->state_name, slot);
+            edge_count += p_states[slot]->transitions.size();
+        }
+    }
+
+    PackedInt32Array out;
+    out.resize(edge_count);
+    int32_t *edges = out.ptrw();
+    for (const Ref<State> &state : p_states) {
+        if (state.is_null()) {
+            continue;
+        }
+        for (const Ref<StateTransition> &transition : state->transitions) {
+            const int32_t *slot = transition.is_valid() ? slots.getptr(transition->to_state_name) : nullptr;
+            *edges++ = nullptr == slot ? -1 : *slot;
+        }
+    }
+    return out;
+}
+
+void StateMachineGraph::_unpack_edges(const Vector<Ref<State>> &p_states, const PackedInt32Array &p_edges) {
+    // primes each transition's cached target id, so the first bake doesn't resolve every target by name
+    const int32_t *edges = p_edges.ptr();
+    int64_t edge = 0;
+    for (const Ref<State> &state : p_states) {
+        if (state.is_null()) {
+            continue;
+        }
+        for (const Ref<StateTransition> &transition : state->transitions) {
+            if (edge >= p_edges.size()) {
+                return;
+            }
+            int32_t slot = edges[edge++];
+            if (transition.is_null() || slot < 0 || slot >= p_states.size() || p_states[slot].is_null()) {
+                continue;
+            }
+            // the names are still authoritative, a stale index is simply ignored
+            if (p_states[slot]->state_name == transition->to_state_name) {
+                transition->to_state_id = p_states[slot]->state_id;
+            }
+        }
+    }
+}
+
+void StateMachineGraph::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("get_all_states"), &StateMachineGraph::get_all_states);
+    ClassDB::bind_method(D_METHOD("get_any_transitions"), &StateMachineGraph::get_any_transitions);
+    ClassDB::bind_method(D_METHOD("get_default_state_name"), &StateMachineGraph::get_default_state_name);
+    ClassDB::bind_method(D_METHOD("get_instance_count"), &StateMachineGraph::get_instance_count);
+}
+
+void StateMachineGraph::_get_property_list(List<PropertyInfo> *p_list) const {
+    p_list->push_back(PropertyInfo(
+        Variant::STRING_NAME, "default_state_name", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_DEFAULT | PROPERTY_USAGE_INTERNAL));
+    p_list->push_back(PropertyInfo(
+        Variant::ARRAY, "_states", PROPERTY_HINT_ARRAY_TYPE, "State", PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL));
+    p_list->push_back(PropertyInfo(
+        Variant::PACKED_INT32_ARRAY, "_edges", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL));
+    p_list->push_back(PropertyInfo(
+        Variant::ARRAY, "_any_transitions", PROPERTY_HINT_ARRAY_TYPE, "StateTransition", PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL));
+}
+
+bool StateMachineGraph::_set(const StringName &p_name, const Variant &p_value) {
+    if (p_name == StringName("default_state_name")) {
+        default_state_name = p_value;
+        return true;
+    } else if (p_name == StringName("_states")) {
+        Array in = p_value;
+        for (const Ref<State> &state : states) {
+            if (state.is_valid()) {
+                state->graph = nullptr;
+            }
+        }
+        states.resize(in.size());
+        Ref<State> *out = states.ptrw();
+        for (int64_t idx = 0; idx < in.size(); ++idx) {
+            out[idx] = in[idx];
+            if (out[idx].is_valid() && out[idx]->_has_owner()) {
+                // duplicate() copies the array but not the states in it, they still belong to the original
+                out[idx] = out[idx]->duplicate(true);
+            }
+            if (out[idx].is_valid()) {
+                out[idx]->graph = this;
+            }
+        }
+        return true;
+    } else if (p_name == StringName("_edges")) {
+        _unpack_edges(states, p_value);
+        return true;
+    } else if (p_name == StringName("_any_transitions")) {
+        Array in = p_value;
+        for (const Ref<StateTransition> &transition : any_transitions) {
+            if (transition.is_valid()) {
+                transition->any_graph = nullptr;
+            }
+        }
+        any_transitions.resize(in.size());
+        Ref<StateTransition> *out = any_transitions.ptrw();
+        for (int64_t idx = 0; idx < in.size(); ++idx) {
+            out[idx] = in[idx];
+            if (out[idx].is_valid() && out[idx]->_has_owner()) {
+                out[idx] = out[idx]->_duplicate_for(nullptr);
+            }
+            if (out[idx].is_valid()) {
+                out[idx]->any_graph = this;
+            }
+        }
+        return true;
+    } else if (p_name.begins_with("states/")) {
+        Ref<State> state = p_value;
+        if (state.is_null()) {
+            return false;
+        }
+        int idx = p_name.get_slice("/", 1).to_int();
+        if (idx >= states.size()) {
+            states.resize(idx + 1);
+        }
+        if (states[idx].is_valid()) {
+            states[idx]->graph = nullptr;
+        }
+        if (state->_has_owner()) {
+            state = state->duplicate(true);
+        }
+        states.set(idx, state);
+        state->graph = this;
+        return true;
+    } else if (p_name.begins_with("any_transitions/")) {
+        Ref<StateTransition> transition = p_value;
+        if (transition.is_null()) {
+            return false;
+        }
+        int idx = p_name.get_slice("/", 1).to_int();
+        if (idx >= any_transitions.size()) {
+            any_transitions.resize(idx + 1);
+        }
+        if (any_transitions[idx].is_valid()) {
+            any_transitions[idx]->any_graph = nullptr;
+        }
+        if (transition->_has_owner()) {
+            transition = transition->_duplicate_for(nullptr);
+        }
+        any_transitions.set(idx, transition);
+        transition->any_graph = this;
+        return true;
+    }
+
+    return false;
+}
+
+bool StateMachineGraph::_get(const StringName &p_name, Variant &r_ret) const {
+    if (p_name == StringName("default_state_name")) {
+        r_ret = default_state_name;
+        return true;
+    } else if (p_name == StringName("_states")) {
+        r_ret = get_all_states();
+        return true;
+    } else if (p_name == StringName("_edges")) {
+        r_ret = _pack_edges(states);
+        return true;
+    } else if (p_name == StringName("_any_transitions")) {
+        r_ret = get_any_transitions();
+        return true;
+    } else if (p_name.begins_with("states/")) {
+        int64_t idx = p_name.get_slice("/", 1).to_int();
+        r_ret = idx < states.size() ? states[idx] : Ref<State>();
+        return true;
+    } else if (p_name.begins_with("any_transitions/")) {
+        int64_t idx = p_name.get_slice("/", 1).to_int();
+        r_ret = idx < any_transitions.size() ? any_transitions[idx] : Ref<StateTransition>();
+        return true;
+    }
+
+    return false;
+}
+
+StateMachineGraph::StateMachineGraph() {
+}
+
+StateMachineGraph::~StateMachineGraph() {
+    for (const Ref<State> &state : states) {
+        if (state.is_valid()) {
+            state->graph = nullptr;
+        }
+    }
+    for (const Ref<StateTransition> &transition : any_transitions) {
+        if (transition.is_valid()) {
+            transition->any_graph = nullptr;
+        }
+    }
+}
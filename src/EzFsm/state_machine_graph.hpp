@@ -0,0 +1,60 @@
+#ifndef __GDSTATEMACHINEGRAPH_H__
+#define __GDSTATEMACHINEGRAPH_H__
+
+#include <godot_cpp/classes/resource.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/templates/vector.hpp>
+#include <godot_cpp/variant/packed_int32_array.hpp>
+#include <godot_cpp/variant/typed_array.hpp>
+
+namespace godot::ez_fsm {
+
+class State;
+class StateMachine;
+class StateTransition;
+
+// Topology of a state machine, shared by every StateMachine it is assigned to.  The states and transitions
+// are owned here and never duplicated per instance; each machine only keeps its runtime data and lookups.
+class StateMachineGraph : public Resource {
+    GDCLASS(StateMachineGraph, Resource)
+
+friend class StateMachine;
+friend class State;
+friend class StateTransition;
+
+public:
+    TypedArray<State> get_all_states() const;
+    TypedArray<StateTransition> get_any_transitions() const;
+    StringName get_default_state_name() const;
+    int64_t get_instance_count() const;
+
+    StateMachineGraph();
+    ~StateMachineGraph();
+
+protected:
+    static void _bind_methods();
+    void _get_property_list(List<PropertyInfo> *p_list) const;
+    bool _set(const StringName &p_name, const Variant &p_value);
+    bool _get(const StringName &p_name, Variant &r_ret) const;
+
+private:
+    Vector<Ref<State>> states;
+    Vector<Ref<StateTransition>> any_transitions;
+    StringName default_state_name;
+    LocalVector<StateMachine *> machines; // every machine using the graph, in the order they were assigned it
+
+    void _attach(StateMachine *p_machine);
+    void _detach(StateMachine *p_machine);
+    StateMachine *_get_machine() const;
+    StateMachine *_get_any_machine() const;
+    void _publish(StateMachine *p_source);
+    void _graph_changed();
+
+    // target slot of every state transition, flattened in state then priority order, -1 when unresolved
+    static PackedInt32Array _pack_edges(const Vector<Ref<State>> &p_states);
+    static void _unpack_edges(const Vector<Ref<State>> &p_states, const PackedInt32Array &p_edges);
+};
+
+}
+
+#endif
@@ -0,0 +1,272 @@
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/classes/window.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#include "state_machine_server.hpp"
+#include "state_machine.hpp"
+
+using namespace godot;
+using namespace godot::ez_fsm;
+
+StateMachineServer *StateMachineServer::singleton = nullptr;
+
+StateMachineServer *StateMachineServer::get_singleton() {
+    return singleton;
+}
+
+int64_t StateMachineServer::get_machine_count() const {
+    return lists[CALLBACK_PROCESS].machines.size();
+}
+
+int64_t StateMachineServer::get_physics_machine_count() const {
+    return lists[CALLBACK_PHYSICS_PROCESS].machines.size();
+}
+
+void StateMachineServer::set_use_threads(bool p_use_threads) {
+    use_threads = p_use_threads;
+}
+
+bool StateMachineServer::is_using_threads() const {
+    return use_threads;
+}
+
+void StateMachineServer::set_frame_budget_msec(double p_budget) {
+    frame_budget_msec = MAX(p_budget, 0.0);
+}
+
+double StateMachineServer::get_frame_budget_msec() const {
+    return frame_budget_msec;
+}
+
+int64_t StateMachineServer::get_ticked_count() const {
+    return last_ticked;
+}
+
+int64_t StateMachineServer::get_deferred_count() const {
+    return last_deferred;
+}
+
+double StateMachineServer::get_budget_used_msec() const {
+    return last_used_msec;
+}
+
+SceneTree *StateMachineServer::_get_tree() const {
+    return Object::cast_to<SceneTree>(ObjectDB::get_instance(tree_id));
+}
+
+void StateMachineServer::_add_machine(StateMachine *p_machine, StateCallback p_callback) {
+    ERR_FAIL_NULL(p_machine);
+    ERR_FAIL_COND(p_callback != CALLBACK_PROCESS && p_callback != CALLBACK_PHYSICS_PROCESS);
+    if (p_machine->server_indices[p_callback] >= 0) {
+        return;
+    }
+
+    if (nullptr == _get_tree()) {
+        SceneTree *tree = p_machine->get_tree();
+        ERR_FAIL_NULL_MSG(tree, "Server driven state machines need to be inside the scene tree.");
+        tree->connect("process_frame", callable_mp(this, &StateMachineServer::_process_frame));
+        tree->connect("physics_frame", callable_mp(this, &StateMachineServer::_physics_frame));
+        tree_id = tree->get_instance_id();
+    }
+
+    MachineList &list = lists[p_callback];
+    p_machine->server_indices[p_callback] = list.machines.size();
+    p_machine->server_tick_times[p_callback] = list.now;
+    list.machines.push_back(p_machine);
+}
+
+void StateMachineServer::_remove_machine(StateMachine *p_machine, StateCallback p_callback) {
+    ERR_FAIL_NULL(p_machine);
+    ERR_FAIL_COND(p_callback != CALLBACK_PROCESS && p_callback != CALLBACK_PHYSICS_PROCESS);
+    int32_t idx = p_machine->server_indices[p_callback];
+    if (idx < 0) {
+        return;
+    }
+
+    MachineList &list = lists[p_callback];
+    ERR_FAIL_COND(uint32_t(idx) >= list.machines.size() || list.machines[idx] != p_machine);
+    p_machine->server_indices[p_callback] = -1;
+
+    // swapping in the last machine would move it in front of the round-robin cursor and skip it for a round
+    list.machines[idx] = nullptr;
+    list.has_holes = true;
+    if (!list.iterating) {
+        _compact(p_callback);
+    }
+}
+
+void StateMachineServer::_tick(StateCallback p_callback, double p_delta) {
+    MachineList &list = lists[p_callback];
+    list.now += p_delta;
+
+    // machines added during the loop wait for the next frame, like nodes that start processing mid-frame
+    uint32_t count = list.machines.size();
+    if (count == 0) {
+        return;
+    }
+    if (list.cursor >= count) {
+        list.cursor = 0;
+    }
+
+    Time *time = Time::get_singleton();
+    uint64_t start = time->get_ticks_usec();
+    uint64_t budget_usec = frame_budget_msec * 1000.0;
+    uint32_t ticked = 0;
+    uint32_t visited = 0;
+
+    list.iterating = true;
+    for (; visited < count; ++visited) {
+        // at least one machine runs per tick so an exhausted budget still makes progress
+        if (budget_usec > 0 && ticked > 0) {
+            uint64_t queued_usec = jobs.size() * job_cost_usec;
+            if (frame_used_usec + (time->get_ticks_usec() - start) + queued_usec >= budget_usec) {
+                break;
+            }
+        }
+
+        StateMachine *machine = list.machines[(list.cursor + visited) % count];
+        if (nullptr == machine) {
+            continue;
+        }
+
+        double delta = list.now - machine->server_tick_times[p_callback];
+        machine->server_tick_times[p_callback] = list.now;
+        if (!machine->can_process()) {
+            continue;
+        }
+        if (machine->_prepare_tick(p_callback, delta)) {
+            if (use_threads && machine->_can_tick_on_thread(p_callback)) {
+                jobs.push_back(Job{ machine, machine->get_instance_id(), delta });
+            } else {
+                machine->_evaluate_tick(p_callback, delta);
+            }
+        }
+        ++ticked;
+    }
+
+    if (!jobs.is_empty()) {
+        _run_jobs(p_callback);
+    }
+    list.iterating = false;
+
+    list.cursor = (list.cursor + visited) % count;
+    frame_used_usec += time->get_ticks_usec() - start;
+    frame_ticked += ticked;
+    frame_deferred += count - visited;
+
+    if (list.has_holes) {
+        _compact(p_callback);
+    }
+}
+
+void StateMachineServer::_run_jobs(StateCallback p_callback) {
+    for (Job &job : jobs) {
+        job.machine->deferring_transitions = true;
+    }
+
+    job_callback = p_callback;
+    Time *time = Time::get_singleton();
+    uint64_t start = time->get_ticks_usec();
+    WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+    int64_t task = pool->add_group_task(callable_mp(this, &StateMachineServer::_run_job), jobs.size(), -1, true, "StateMachineServer");
+    pool->wait_for_group_task_completion(task);
+    job_cost_usec = double(time->get_ticks_usec() - start) / jobs.size();
+
+    // commit phase: transitions triggered on the workers activate their targets here on the main thread, in
+    // the order the machines were ticked.  A commit can free other machines, so each one is looked up again.
+    for (const Job &job : jobs) {
+        StateMachine *machine = Object::cast_to<StateMachine>(ObjectDB::get_instance(job.machine_id));
+        if (nullptr != machine) {
+            machine->_commit_tick();
+        }
+    }
+    jobs.clear();
+}
+
+void StateMachineServer::_run_job(uint32_t p_index) {
+    const Job &job = jobs[p_index];
+    job.machine->_evaluate_tick(job_callback, job.delta);
+}
+
+void StateMachineServer::_compact(StateCallback p_callback) {
+    MachineList &list = lists[p_callback];
+
+    uint32_t kept = 0;
+    uint32_t cursor = 0;
+    for (uint32_t idx = 0; idx < list.machines.size(); ++idx) {
+        if (idx == list.cursor) {
+            cursor = kept;
+        }
+        StateMachine *machine = list.machines[idx];
+        if (nullptr == machine) {
+            continue;
+        }
+        machine->server_indices[p_callback] = kept;
+        list.machines[kept++] = machine;
+    }
+    list.machines.resize(kept);
+    list.cursor = cursor;
+    list.has_holes = false;
+}
+
+void StateMachineServer::_process_frame() {
+    SceneTree *tree = _get_tree();
+    ERR_FAIL_NULL(tree);
+    _tick(CALLBACK_PROCESS, tree->get_root()->get_process_delta_time());
+
+    last_ticked = frame_ticked;
+    last_deferred = frame_deferred;
+    last_used_msec = frame_used_usec / 1000.0;
+    frame_ticked = 0;
+    frame_deferred = 0;
+    frame_used_usec = 0;
+}
+
+void StateMachineServer::_physics_frame() {
+    SceneTree *tree = _get_tree();
+    ERR_FAIL_NULL(tree);
+    _tick(CALLBACK_PHYSICS_PROCESS, tree->get_root()->get_physics_process_delta_time());
+}
+
+void StateMachineServer::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("get_machine_count"), &StateMachineServer::get_machine_count);
+    ClassDB::bind_method(D_METHOD("get_physics_machine_count"), &StateMachineServer::get_physics_machine_count);
+    ClassDB::bind_method(D_METHOD("get_ticked_count"), &StateMachineServer::get_ticked_count);
+    ClassDB::bind_method(D_METHOD("get_deferred_count"), &StateMachineServer::get_deferred_count);
+    ClassDB::bind_method(D_METHOD("get_budget_used_msec"), &StateMachineServer::get_budget_used_msec);
+
+    ClassDB::bind_method(D_METHOD("set_use_threads", "use_threads"), &StateMachineServer::set_use_threads);
+    ClassDB::bind_method(D_METHOD("is_using_threads"), &StateMachineServer::is_using_threads);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_threads"), "set_use_threads", "is_using_threads");
+
+    ClassDB::bind_method(D_METHOD("set_frame_budget_msec", "budget"), &StateMachineServer::set_frame_budget_msec);
+    ClassDB::bind_method(D_METHOD("get_frame_budget_msec"), &StateMachineServer::get_frame_budget_msec);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "frame_budget_msec", PROPERTY_HINT_RANGE, "0,16,0.01,or_greater,suffix:ms"), "set_frame_budget_msec", "get_frame_budget_msec");
+}
+
+StateMachineServer::StateMachineServer() {
+    singleton = this;
+}
+
+StateMachineServer::~StateMachineServer() {
+    for (MachineList &list : lists) {
+        for (StateMachine *machine : list.machines) {
+            if (nullptr != machine) {
+                machine->server_indices[CALLBACK_PROCESS] = -1;
+                machine->server_indices[CALLBACK_PHYSICS_PROCESS] = -1;
+            }
+        }
+    }
+
+    SceneTree *tree = _get_tree();
+    if (nullptr != tree) {
+        Callable process = callable_mp(this, &StateMachineServer::_process_frame);
+        if (tree->is_connected("process_frame", process)) {
+            tree->disconnect("process_frame", process);
+        }
+        Callable physics = callable_mp(this, &StateMachineServer::_physics_frame);
+        if (tree->is_connected("physics_frame", physics)) {
+            tree->disconnect("physics_frame", physics);
+        }
+    }
+    singleton = nullptr;
+}
@@ -0,0 +1,93 @@
+#ifndef __GDSTATEMACHINESERVER_H__
+#define __GDSTATEMACHINESERVER_H__
+
+#include <godot_cpp/classes/object.hpp>
+#include <godot_cpp/classes/scene_tree.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+
+#include "state_callbacks.hpp"
+
+namespace godot::ez_fsm {
+
+class StateMachine;
+
+// Drives the process and physics process callbacks of every StateMachine with server_driven enabled from
+// one loop over a dense array, instead of having the SceneTree notify each machine node separately.
+class StateMachineServer : public Object {
+    GDCLASS(StateMachineServer, Object)
+
+friend class StateMachine;
+
+public:
+    static StateMachineServer *get_singleton();
+
+    int64_t get_machine_count() const;
+    int64_t get_physics_machine_count() const;
+
+    void set_use_threads(bool p_use_threads);
+    bool is_using_threads() const;
+
+    void set_frame_budget_msec(double p_budget);
+    double get_frame_budget_msec() const;
+
+    int64_t get_ticked_count() const;
+    int64_t get_deferred_count() const;
+    double get_budget_used_msec() const;
+
+    StateMachineServer();
+    ~StateMachineServer();
+
+protected:
+    static void _bind_methods();
+
+private:
+    static StateMachineServer *singleton;
+
+    // one list per driven callback, kept in round-robin order; a machine remembers its index in each
+    struct MachineList {
+        LocalVector<StateMachine *> machines;
+        uint32_t cursor = 0; // where the next tick starts, so machines cut off by the budget go first
+        double now = 0.0; // sum of every tick's delta
+        bool iterating = false;
+        bool has_holes = false; // machines removed while iterating leave a nullptr behind
+    };
+
+    MachineList lists[2]; // indexed by CALLBACK_PROCESS and CALLBACK_PHYSICS_PROCESS
+    uint64_t tree_id = 0; // the tree whose frame signals drive the lists, looked up again since it can be freed first
+
+    // machines whose evaluation was handed to the WorkerThreadPool during the current tick
+    struct Job {
+        StateMachine *machine = nullptr;
+        uint64_t machine_id = 0;
+        double delta = 0.0;
+    };
+    bool use_threads = false;
+    LocalVector<Job> jobs;
+    StateCallback job_callback = CALLBACK_PROCESS;
+    // wall time per job of the last group task, so jobs queued for the workers count against the frame budget
+    double job_cost_usec = 0.0;
+
+    // a frame runs from the end of one process tick to the end of the next, covering the physics ticks between
+    double frame_budget_msec = 0.0;
+    uint64_t frame_used_usec = 0;
+    uint32_t frame_ticked = 0;
+    uint32_t frame_deferred = 0;
+    // totals of the last completed frame
+    uint32_t last_ticked = 0;
+    uint32_t last_deferred = 0;
+    double last_used_msec = 0.0;
+
+    SceneTree *_get_tree() const;
+    void _add_machine(StateMachine *p_machine, StateCallback p_callback);
+    void _remove_machine(StateMachine *p_machine, StateCallback p_callback);
+    void _tick(StateCallback p_callback, double p_delta);
+    void _compact(StateCallback p_callback);
+    void _run_jobs(StateCallback p_callback);
+    void _run_job(uint32_t p_index);
+    void _process_frame();
+    void _physics_frame();
+};
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "state_transition.hpp"
 #include "state.hpp"
 #include "state_machine.hpp"
+#include "state_machine_graph.hpp"
 
 using namespace godot;
 using namespace ez_fsm;
@@ -13,26 +14,91 @@ void StateTransition::_set_from_state(Ref<State> p_state) {
     }
 }
 
+bool StateTransition::_has_owner() const {
+    return from_state.is_valid() || nullptr != any_machine || nullptr != any_graph;
+}
+
+Ref<StateTransition> StateTransition::_duplicate_for(State *p_state) const {
+    Ref<StateTransition> copy = duplicate(true);
+    copy->to_state_id = to_state_id; // not a property, but still valid for a copy of the same topology
+    copy->from_state = Ref<State>(p_state);
+    return copy;
+}
+
+void StateTransition::_update_callbacks() {
+    uint8_t new_callbacks = 0;
+
+    if (GDVIRTUAL_IS_OVERRIDDEN(_process)) {
+        new_callbacks |= CALLBACK_BIT(CALLBACK_PROCESS);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_physics_process)) {
+        new_callbacks |= CALLBACK_BIT(CALLBACK_PHYSICS_PROCESS);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_input)) {
+        new_callbacks |= CALLBACK_BIT(CALLBACK_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_shortcut_input)) {
+        new_callbacks |= CALLBACK_BIT(CALLBACK_SHORTCUT_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_unhandled_input)) {
+        new_callbacks |= CALLBACK_BIT(CALLBACK_UNHANDLED_INPUT);
+    }
+    if (GDVIRTUAL_IS_OVERRIDDEN(_unhandled_key_input)) {
+        new_callbacks |= CALLBACK_BIT(CALLBACK_UNHANDLED_KEY_INPUT);
+    }
+
+    if (new_callbacks != callbacks) {
+        callbacks = new_callbacks;
+        _graph_changed();
+    }
+}
+
+void StateTransition::_graph_changed() {
+    if (from_state.is_valid()) {
+        from_state->_graph_changed();
+    } else if (nullptr != any_machine) {
+        any_machine->_graph_changed();
+    } else if (nullptr != any_graph) {
+        any_graph->_graph_changed();
+    }
+}
+
+StateMachine *StateTransition::_get_any_machine() const {
+    if (nullptr != any_machine) {
+        return any_machine;
+    }
+
+    return nullptr == any_graph ? nullptr : any_graph->_get_any_machine();
+}
+
+StateMachine *StateTransition::_get_owner() const {
+    return from_state.is_valid() ? from_state->_get_owner() : _get_any_machine();
+}
+
 Ref<State> StateTransition::get_from_state() const {
     return from_state;
 }
 
 void StateTransition::set_to_state(Ref<State> p_state) {
     StringName new_name;
+    int64_t new_id = -1;
     if (p_state.is_valid()) {
         new_name = p_state->get_state_name();
+        new_id = p_state->get_state_id();
     }
 
     to_state_name = new_name;
+    to_state_id = new_id;
+    _graph_changed();
 }
 
 Ref<State> StateTransition::get_to_state() const {
-    StateMachine *machine = get_state_machine();
+    StateMachine *machine = _get_owner();
     if (nullptr == machine) {
         return Ref<State>();
     }
 
-    return machine->get_state(to_state_name);
+    return machine->_get_state(machine->_get_target_slot(this));
 }
 
 
@@ -43,6 +109,121 @@ void StateTransition::set_state_input(Ref<StateInput> p_state_input) {
     }
 }
 
+void StateTransition::set_event(const StringName &p_event) {
+    if (p_event != event) {
+        event = p_event;
+        _graph_changed();
+        emit_changed();
+    }
+}
+
+void StateTransition::set_excluded_states(const PackedStringArray &p_states) {
+    excluded_states = p_states;
+    _graph_changed();
+    emit_changed();
+}
+
+PackedStringArray StateTransition::get_excluded_states() const {
+    return excluded_states;
+}
+
+StringName StateTransition::get_event() const {
+    return event;
+}
+
+void StateTransition::set_timeout(double p_timeout) {
+    p_timeout = MAX(p_timeout, 0.0);
+    if (p_timeout != timeout) {
+        timeout = p_timeout;
+        _graph_changed();
+        emit_changed();
+    }
+}
+
+double StateTransition::get_timeout() const {
+    return timeout;
+}
+
+void StateTransition::set_timeout_jitter(double p_jitter) {
+    p_jitter = MAX(p_jitter, 0.0);
+    if (p_jitter != timeout_jitter) {
+        timeout_jitter = p_jitter;
+        emit_changed();
+    }
+}
+
+double StateTransition::get_timeout_jitter() const {
+    return timeout_jitter;
+}
+
+void StateTransition::set_evaluation_interval(double p_interval) {
+    p_interval = MAX(p_interval, 0.0);
+    if (p_interval != evaluation_interval) {
+        evaluation_interval = p_interval;
+        _graph_changed();
+        emit_changed();
+    }
+}
+
+double StateTransition::get_evaluation_interval() const {
+    return evaluation_interval;
+}
+
+void StateTransition::set_evaluation_interval_mode(IntervalMode p_mode) {
+    if (p_mode != evaluation_interval_mode) {
+        evaluation_interval_mode = p_mode;
+        _graph_changed();
+        emit_changed();
+    }
+}
+
+StateTransition::IntervalMode StateTransition::get_evaluation_interval_mode() const {
+    return evaluation_interval_mode;
+}
+
+void StateTransition::set_thread_safe(bool p_thread_safe) {
+    if (p_thread_safe != thread_safe) {
+        thread_safe = p_thread_safe;
+        _graph_changed();
+        emit_changed();
+    }
+}
+
+bool StateTransition::is_thread_safe() const {
+    return thread_safe;
+}
+
+void StateTransition::set_signal_source(const NodePath &p_source) {
+    if (p_source != signal_source) {
+        signal_source = p_source;
+        emit_changed();
+    }
+}
+
+NodePath StateTransition::get_signal_source() const {
+    return signal_source;
+}
+
+void StateTransition::set_signal_name(const StringName &p_signal) {
+    if (p_signal != signal_name) {
+        signal_name = p_signal;
+        _graph_changed();
+        emit_changed();
+    }
+}
+
+StringName StateTransition::get_signal_name() const {
+    return signal_name;
+}
+
+Ref<StateInput> StateTransition::get_state_input() {
+    if (input.is_null()) {
+        input.instantiate();
+    }
+
+    return input;
+}
+
 void StateTransition::set_context(Node *p_context) {
     StateMachine *machine = get_state_machine();
 
@@ -68,6 +249,11 @@ StateMachine *StateTransition::get_state_machine() const {
 
     if (from_state.is_valid()) {
         machine = from_state->get_state_machine();
+    } else if (nullptr != any_machine || nullptr == any_graph) {
+        machine = any_machine;
+    } else {
+        machine = any_graph->_get_machine();
+        ERR_FAIL_NULL_V_MSG(machine, nullptr, "Any-state transition is shared through a StateMachineGraph, its machine is only known inside that machine's callbacks.");
     }
 
     return machine;
@@ -79,12 +265,53 @@ bool StateTransition::request_transition() {
     if (nullptr == machine) {
         return false;
     } else {
-        return machine->transition_to(to_state_name, input);
+        return machine->_request_transition(this);
     }
 }
 
 void StateTransition::_bind_methods() {
     ClassDB::bind_method(D_METHOD("set_state_input", "state_input"), &StateTransition::set_state_input);
+    ClassDB::bind_method(D_METHOD("get_state_input"), &StateTransition::get_state_input);
+    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "state_input", PROPERTY_HINT_RESOURCE_TYPE, "StateInput", PROPERTY_USAGE_NONE), "set_state_input", "get_state_input");
+
+    ClassDB::bind_method(D_METHOD("set_event", "event"), &StateTransition::set_event);
+    ClassDB::bind_method(D_METHOD("get_event"), &StateTransition::get_event);
+    ADD_PROPERTY(PropertyInfo(Variant::STRING_NAME, "event"), "set_event", "get_event");
+
+    ClassDB::bind_method(D_METHOD("set_timeout", "timeout"), &StateTransition::set_timeout);
+    ClassDB::bind_method(D_METHOD("get_timeout"), &StateTransition::get_timeout);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "timeout", PROPERTY_HINT_RANGE, "0,60,0.01,or_greater,suffix:s"), "set_timeout", "get_timeout");
+
+    ClassDB::bind_method(D_METHOD("set_timeout_jitter", "jitter"), &StateTransition::set_timeout_jitter);
+    ClassDB::bind_method(D_METHOD("get_timeout_jitter"), &StateTransition::get_timeout_jitter);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "timeout_jitter", PROPERTY_HINT_RANGE, "0,60,0.01,or_greater,suffix:s"), "set_timeout_jitter", "get_timeout_jitter");
+
+    ClassDB::bind_method(D_METHOD("set_evaluation_interval", "interval"), &StateTransition::set_evaluation_interval);
+    ClassDB::bind_method(D_METHOD("get_evaluation_interval"), &StateTransition::get_evaluation_interval);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "evaluation_interval", PROPERTY_HINT_RANGE, "0,10,0.01,or_greater"), "set_evaluation_interval", "get_evaluation_interval");
+
+    ClassDB::bind_method(D_METHOD("set_evaluation_interval_mode", "mode"), &StateTransition::set_evaluation_interval_mode);
+    ClassDB::bind_method(D_METHOD("get_evaluation_interval_mode"), &StateTransition::get_evaluation_interval_mode);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "evaluation_interval_mode", PROPERTY_HINT_ENUM, "Seconds,Frames"), "set_evaluation_interval_mode", "get_evaluation_interval_mode");
+
+    BIND_ENUM_CONSTANT(INTERVAL_SECONDS);
+    BIND_ENUM_CONSTANT(INTERVAL_FRAMES);
+
+    ClassDB::bind_method(D_METHOD("set_excluded_states", "states"), &StateTransition::set_excluded_states);
+    ClassDB::bind_method(D_METHOD("get_excluded_states"), &StateTransition::get_excluded_states);
+    ADD_PROPERTY(PropertyInfo(Variant::PACKED_STRING_ARRAY, "excluded_states"), "set_excluded_states", "get_excluded_states");
+
+    ClassDB::bind_method(D_METHOD("set_thread_safe", "thread_safe"), &StateTransition::set_thread_safe);
+    ClassDB::bind_method(D_METHOD("is_thread_safe"), &StateTransition::is_thread_safe);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "thread_safe"), "set_thread_safe", "is_thread_safe");
+
+    ClassDB::bind_method(D_METHOD("set_signal_source", "source"), &StateTransition::set_signal_source);
+    ClassDB::bind_method(D_METHOD("get_signal_source"), &StateTransition::get_signal_source);
+    ADD_PROPERTY(PropertyInfo(Variant::NODE_PATH, "signal_source"), "set_signal_source", "get_signal_source");
+
+    ClassDB::bind_method(D_METHOD("set_signal_name", "signal"), &StateTransition::set_signal_name);
+    ClassDB::bind_method(D_METHOD("get_signal_name"), &StateTransition::get_signal_name);
+    ADD_PROPERTY(PropertyInfo(Variant::STRING_NAME, "signal_name"), "set_signal_name", "get_signal_name");
 
     ClassDB::bind_method(D_METHOD("get_state_machine"), &StateTransition::get_state_machine);
     ClassDB::bind_method(D_METHOD("request_transition"), &StateTransition::request_transition);
@@ -110,7 +337,7 @@ void StateTransition::_bind_methods() {
 
 void StateTransition::_get_property_list(List<PropertyInfo> *p_list) const {
     String hint_string = "";
-    StateMachine *machine = get_state_machine();
+    StateMachine *machine = _get_owner();
     if (nullptr != machine) {
         hint_string = String(",").join(machine->get_all_state_names());
     }
@@ -139,6 +366,8 @@ bool StateTransition::_property_get_revert(StringName p_name, Variant &r_value)
 bool StateTransition::_set(StringName p_name, const Variant &p_value) {
     if (p_name == StringName("to_state_name")) {
         to_state_name = p_value;
+        to_state_id = -1;
+        _graph_changed();
         emit_changed();
         return true;
     }
@@ -157,6 +386,7 @@ bool StateTransition::_get(StringName p_name, Variant &r_value) const {
 
 StateTransition::StateTransition() {
     set_local_to_scene(true);
+    connect("script_changed", callable_mp(this, &StateTransition::_update_callbacks));
 }
 
 StateTransition::~StateTransition() {
@@ -7,25 +7,62 @@
 #include <godot_cpp/classes/input_event.hpp>
 #include <godot_cpp/core/gdvirtual.gen.inc>
 
+#include "state_callbacks.hpp"
+
 namespace godot::ez_fsm {
 
 class State;
 class StateMachine;
+class StateMachineGraph;
 class StateInput;
 
 class StateTransition : public Resource {
     GDCLASS(StateTransition, Resource)
 
 friend class StateMachine;
+friend class StateMachineGraph;
 friend class State;
 
 public:
+    enum IntervalMode {
+        INTERVAL_SECONDS,
+        INTERVAL_FRAMES,
+    };
+
     Ref<State> get_from_state() const;
     
     void set_to_state(Ref<State> p_state); 
     Ref<State> get_to_state() const;
 
+    void set_event(const StringName &p_event);
+    StringName get_event() const;
+
+    void set_timeout(double p_timeout);
+    double get_timeout() const;
+
+    void set_timeout_jitter(double p_jitter);
+    double get_timeout_jitter() const;
+
+    void set_evaluation_interval(double p_interval);
+    double get_evaluation_interval() const;
+
+    void set_evaluation_interval_mode(IntervalMode p_mode);
+    IntervalMode get_evaluation_interval_mode() const;
+
+    void set_excluded_states(const PackedStringArray &p_states);
+    PackedStringArray get_excluded_states() const;
+
+    void set_thread_safe(bool p_thread_safe);
+    bool is_thread_safe() const;
+
+    void set_signal_source(const NodePath &p_source);
+    NodePath get_signal_source() const;
+
+    void set_signal_name(const StringName &p_signal);
+    StringName get_signal_name() const;
+
     void set_state_input(Ref<StateInput> p_state_input);
+    Ref<StateInput> get_state_input();
 
     void set_context(Node *p_context);
     Node *get_context() const;
@@ -54,12 +91,35 @@ protected:
 
 private:
     Ref<State> from_state;
+    StateMachine *any_machine = nullptr; // owner of an any-state transition, which has no from_state
+    StateMachineGraph *any_graph = nullptr; // set instead of any_machine when that owner is a shared graph
+    PackedStringArray excluded_states; // states an any-state transition never fires from
     StringName to_state_name;
+    int64_t to_state_id = -1; // cached handle of the target, kept in sync by the machine
+    StringName event;
+    double timeout = 0.0;
+    double timeout_jitter = 0.0;
+    NodePath signal_source;
+    StringName signal_name;
+    double evaluation_interval = 0.0;
+    IntervalMode evaluation_interval_mode = INTERVAL_SECONDS;
+    bool thread_safe = false;
     Ref<StateInput> input;
 
+    // bit mask of StateCallback values whose virtual is overridden by the script
+    uint8_t callbacks = 0;
+
     void _set_from_state(Ref<State> p_state);
+    bool _has_owner() const;
+    Ref<StateTransition> _duplicate_for(State *p_state) const;
+    void _graph_changed();
+    void _update_callbacks();
+    StateMachine *_get_any_machine() const;
+    StateMachine *_get_owner() const;
 };
 
 }
 
+VARIANT_ENUM_CAST(ez_fsm::StateTransition::IntervalMode);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include <godot_cpp/classes/window.hpp>
+#include "transition_timers.hpp"
+#include "state_machine.hpp"
+
+using namespace godot;
+using namespace godot::ez_fsm;
+
+// the heap is rebuilt once stale entries outnumber live ones, and there are at least this many of them
+static constexpr uint32_t STALE_REBUILD_MIN = 64;
+
+LocalVector<TransitionTimers::Timer> TransitionTimers::heap;
+LocalVector<TransitionTimers::Timer> TransitionTimers::held;
+uint32_t TransitionTimers::stale_count = 0;
+double TransitionTimers::now = 0.0;
+uint64_t TransitionTimers::tree_id = 0;
+bool TransitionTimers::advancing = false;
+
+void TransitionTimers::arm(StateMachine *p_machine, uint32_t p_serial, uint64_t p_transition_id, double p_delay) {
+    ERR_FAIL_NULL(p_machine);
+
+    if (nullptr == ObjectDB::get_instance(tree_id)) {
+        // the tree the entries were timed by is gone, and so are their machines
+        heap.clear();
+        held.clear();
+        stale_count = 0;
+
+        SceneTree *tree = p_machine->get_tree();
+        ERR_FAIL_NULL_MSG(tree, "Timed transitions need the state machine to be inside the scene tree.");
+        tree->connect("process_frame", callable_mp_static(&TransitionTimers::_process_frame));
+        tree_id = tree->get_instance_id();
+    }
+
+    Timer timer;
+    timer.deadline = now + p_delay;
+    timer.machine_id = p_machine->get_instance_id();
+    timer.transition_id = p_transition_id;
+    timer.serial = p_serial;
+    _push(timer);
+    ++p_machine->armed_timers;
+}
+
+void TransitionTimers::discard(uint32_t p_count) {
+    stale_count += p_count;
+    _release_if_idle();
+}
+
+void TransitionTimers::advance(double p_delta) {
+    now += p_delta;
+    advancing = true;
+
+    // timeouts of paused machines are held back and retried next frame, outside the heap
+    LocalVector<Timer> retry;
+    SWAP(retry, held);
+    for (uint32_t idx = 0; idx < retry.size(); ++idx) {
+        _expire(retry[idx]);
+    }
+
+    while (!heap.is_empty() && heap[0].deadline <= now) {
+        Timer timer = heap[0];
+        _pop();
+        _expire(timer);
+    }
+
+    if (stale_count >= STALE_REBUILD_MIN && stale_count * 2 > heap.size() + held.size()) {
+        _rebuild();
+    }
+    advancing = false;
+    _release_if_idle();
+}
+
+uint32_t TransitionTimers::get_pending_count() {
+    return heap.size() + held.size() - stale_count;
+}
+
+void TransitionTimers::reset() {
+    // called when the extension unloads, the buffers must not wait for static destruction after that
+    SceneTree *tree = Object::cast_to<SceneTree>(ObjectDB::get_instance(tree_id));
+    Callable callable = callable_mp_static(&TransitionTimers::_process_frame);
+    if (nullptr != tree && tree->is_connected("process_frame", callable)) {
+        tree->disconnect("process_frame", callable);
+    }
+    heap.reset();
+    held.reset();
+    stale_count = 0;
+    now = 0.0;
+    tree_id = 0;
+    advancing = false;
+}
+
+StateMachine *TransitionTimers::_get_live_machine(const Timer &p_timer) {
+    StateMachine *machine = Object::cast_to<StateMachine>(ObjectDB::get_instance(p_timer.machine_id));
+    if (nullptr == machine || !machine->running || machine->activation_serial != p_timer.serial) {
+        return nullptr;
+    }
+    return machine;
+}
+
+void TransitionTimers::_expire(const Timer &p_timer) {
+    StateMachine *machine = _get_live_machine(p_timer);
+    if (nullptr == machine) {
+        stale_count -= MIN(stale_count, 1u); // already counted when its machine moved on
+        return;
+    }
+
+    // firing activates another state, which discards whatever this machine still has armed
+    --machine->armed_timers;
+    if (!machine->_timer_expired(p_timer.serial, p_timer.transition_id)) {
+        held.push_back(p_timer);
+        ++machine->armed_timers;
+    }
+}
+
+void TransitionTimers::_rebuild() {
+    LocalVector<Timer> entries;
+    SWAP(entries, heap);
+    for (uint32_t idx = 0; idx < entries.size(); ++idx) {
+        if (nullptr != _get_live_machine(entries[idx])) {
+            _push(entries[idx]);
+        }
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t idx = 0; idx < held.size(); ++idx) {
+        if (nullptr != _get_live_machine(held[idx])) {
+            held[kept++] = held[idx];
+        }
+    }
+    held.resize(kept);
+    stale_count = 0;
+}
+
+void TransitionTimers::_release_if_idle() {
+    if (advancing || stale_count < heap.size() + held.size()) {
+        return;
+    }
+
+    // nothing live is pending, so stop listening to the tree until the next timeout is armed
+    heap.clear();
+    held.clear();
+    stale_count = 0;
+    SceneTree *tree = Object::cast_to<SceneTree>(ObjectDB::get_instance(tree_id));
+    Callable callable = callable_mp_static(&TransitionTimers::_process_frame);
+    if (nullptr != tree && tree->is_connected("process_frame", callable)) {
+        tree->disconnect("process_frame", callable);
+    }
+    tree_id = 0;
+}
+
+void TransitionTimers::_push(const Timer &p_timer) {
+    uint32_t idx = heap.size();
+    heap.push_back(p_timer);
+
+    while (idx > 0) {
+        uint32_t parent = (idx - 1) / 2;
+        if (heap[parent].deadline <= p_timer.deadline) {
+            break;
+        }
+        heap[idx] = heap[parent];
+        idx = parent;
+    }
+    heap[idx] = p_timer;
+}
+
+void TransitionTimers::_pop() {
+    Timer last = heap[heap.size() - 1];
+    heap.resize(heap.size() - 1);
+    if (heap.is_empty()) {
+        return;
+    }
+
+    uint32_t idx = 0;
+    uint32_t size = heap.size();
+    while (true) {
+        uint32_t child = idx * 2 + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && heap[child + 1].deadline < heap[child].deadline) {
+            ++child;
+        }
+        if (last.deadline <= heap[child].deadline) {
+            break;
+        }
+        heap[idx] = heap[child];
+        idx = child;
+    }
+    heap[idx] = last;
+}
+
+void TransitionTimers::_process_frame() {
+    SceneTree *tree = Object::cast_to<SceneTree>(ObjectDB::get_instance(tree_id));
+    if (nullptr == tree || tree->is_paused()) {
+        return; // timeouts count game time, like a pausable Timer node
+    }
+    advance(tree->get_root()->get_process_delta_time());
+}
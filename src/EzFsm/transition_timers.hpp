@@ -0,0 +1,49 @@
+#ifndef __GDTRANSITIONTIMERS_H__
+#define __GDTRANSITIONTIMERS_H__
+
+#include <godot_cpp/classes/scene_tree.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+
+namespace godot::ez_fsm {
+
+class StateMachine;
+
+// A single min-heap of pending StateTransition timeouts shared by every StateMachine.  A machine invalidates
+// its pending timeouts by bumping its activation serial and reporting how many it had armed; those stale
+// entries are skipped when they reach the top, and the heap is rebuilt without them once they make up most of
+// it.  Time only advances while the SceneTree isn't paused, and the tree is disconnected once nothing is pending.
+class TransitionTimers {
+public:
+    static void arm(StateMachine *p_machine, uint32_t p_serial, uint64_t p_transition_id, double p_delay);
+    static void discard(uint32_t p_count);
+    static void advance(double p_delta);
+    static uint32_t get_pending_count();
+    static void reset();
+
+private:
+    struct Timer {
+        double deadline = 0.0;
+        uint64_t machine_id = 0;
+        uint64_t transition_id = 0;
+        uint32_t serial = 0;
+    };
+
+    static LocalVector<Timer> heap;
+    static LocalVector<Timer> held; // due, but their machine couldn't fire them yet; retried every frame
+    static uint32_t stale_count; // entries in heap and held whose machine was freed or moved on
+    static double now;
+    static uint64_t tree_id;
+    static bool advancing;
+
+    static StateMachine *_get_live_machine(const Timer &p_timer);
+    static void _expire(const Timer &p_timer);
+    static void _push(const Timer &p_timer);
+    static void _pop();
+    static void _rebuild();
+    static void _release_if_idle();
+    static void _process_frame();
+};
+
+}
+
+#endif
@@ -0,0 +1,5 @@
+extends StateTransition
+
+
+func _process(_delta: float) -> bool:
+	return true
@@ -0,0 +1,5 @@
+extends State
+
+
+func _can_activate(_input: StateInput) -> bool:
+	return false
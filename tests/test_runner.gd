@@ -0,0 +1,413 @@
+extends Node
+
+# Runs every test_* method in order and quits with the number of failed checks:
+#   godot --headless --path . res://tests/test_runner.tscn
+
+
+var failures := 0
+
+
+func _ready() -> void:
+	for method in get_method_list():
+		if method.name.begins_with("test_"):
+			print("- ", method.name)
+			await call(method.name)
+	print("%d check(s) failed" % failures)
+	get_tree().quit(failures)
+
+
+func check(condition: bool, message: String) -> void:
+	if not condition:
+		failures += 1
+		push_error(message)
+
+
+func make_machine(names: PackedStringArray) -> StateMachine:
+	var machine := StateMachine.new()
+	machine.auto_start = false
+	machine.add_states(names)
+	add_child(machine)
+	return machine
+
+
+func wait(seconds: float) -> void:
+	await get_tree().create_timer(seconds).timeout
+
+
+func test_timeout_fires_after_delay() -> void:
+	var machine := make_machine(["Idle", "Alert"])
+	var transition := machine.add_transition_between(machine.get_state("Idle"), machine.get_state("Alert"))
+	transition.timeout = 0.2
+	machine.start()
+	await wait(0.1)
+	check(machine.get_active_state().state_name == &"Idle", "timeout fired early")
+	await wait(0.2)
+	check(machine.get_active_state().state_name == &"Alert", "timeout did not fire")
+	machine.queue_free()
+
+
+func test_timeout_restarts_on_activation() -> void:
+	var machine := make_machine(["Idle", "Alert", "Other"])
+	var transition := machine.add_transition_between(machine.get_state("Idle"), machine.get_state("Alert"))
+	transition.timeout = 0.3
+	machine.start()
+	await wait(0.2)
+	machine.transition_to("Other")
+	machine.transition_to("Idle")
+	await wait(0.2)
+	check(machine.get_active_state().state_name == &"Idle", "timeout armed by an earlier activation fired")
+	await wait(0.2)
+	check(machine.get_active_state().state_name == &"Alert", "timeout did not fire after reactivation")
+	machine.queue_free()
+
+
+func test_timeout_waits_while_paused() -> void:
+	var machine := make_machine(["Idle", "Alert"])
+	var transition := machine.add_transition_between(machine.get_state("Idle"), machine.get_state("Alert"))
+	transition.timeout = 0.2
+	machine.start()
+	get_tree().paused = true
+	await wait(0.4)
+	check(machine.get_active_state().state_name == &"Idle", "timeout fired while the tree was paused")
+	get_tree().paused = false
+	await wait(0.3)
+	check(machine.get_active_state().state_name == &"Alert", "timeout did not fire after unpausing")
+	machine.queue_free()
+
+
+func test_sleep_from_activate_sticks() -> void:
+	var machine := make_machine(["Idle", "Nap"])
+	machine.get_state("Nap").set_script(load("res://tests/test_sleep_state.gd"))
+	machine.start()
+	machine.transition_to("Nap")
+	check(machine.is_sleeping(), "sleep() called from _activate was overwritten")
+	machine.transition_to("Idle")
+	check(not machine.is_sleeping(), "entering a state that doesn't sleep kept the machine asleep")
+	machine.queue_free()
+
+
+func test_threaded_commit_falls_through_refused_target() -> void:
+	var machine := make_machine(["Idle", "Locked", "Open"])
+	machine.get_state("Locked").set_script(preload("res://tests/test_refuse_state.gd"))
+	var idle := machine.get_state("Idle")
+	for target in ["Locked", "Open"]:
+		var transition := machine.add_transition_between(idle, machine.get_state(target))
+		transition.set_script(preload("res://tests/test_always_transition.gd"))
+		transition.thread_safe = true
+	for state in machine.get_all_states():
+		state.thread_safe = true
+	machine.server_driven = true
+	StateMachineServer.use_threads = true
+	machine.start("Idle")
+	await get_tree().process_frame
+	await get_tree().process_frame
+	StateMachineServer.use_threads = false
+	check(machine.get_active_state().state_name == &"Open", "a refused deferred transition kept the next one from firing, active state is %s" % machine.get_active_state().state_name)
+	machine.queue_free()
+
+
+func test_queued_transition_waits_for_start() -> void:
+	var machine := make_machine(["Idle", "Run"])
+	check(machine.queue_transition("Run"), "queueing while stopped failed")
+	machine.start()
+	check(machine.get_active_state().state_name == &"Run", "request queued before start() was dropped")
+	machine.queue_free()
+
+
+func test_queue_transition_from_thread() -> void:
+	var machine := make_machine(["Idle", "Run"])
+	machine.start()
+	var run_id := machine.get_state_id("Run")
+	var thread := Thread.new()
+	thread.start(func() -> bool: return machine.queue_transition(run_id))
+	check(thread.wait_to_finish(), "queue_transition from a thread failed")
+	await get_tree().process_frame
+	await get_tree().process_frame
+	check(machine.get_active_state().state_name == &"Run", "request queued from a thread was not applied")
+	check(machine.get_active_state_id() == run_id, "active state id does not match the active state")
+	machine.queue_free()
+
+
+func test_full_transition_queue_reports_failure() -> void:
+	var machine := make_machine(["Idle", "Run"])
+	machine.transition_queue_capacity = 4
+	var accepted := 0
+	for i in 8:
+		if machine.queue_transition("Run"):
+			accepted += 1
+	check(accepted == 4, "a full queue accepted %d requests instead of 4" % accepted)
+	machine.queue_free()
+
+
+func test_transition_from_activate_runs_after_it() -> void:
+	var machine := make_machine(["Idle", "Hop", "Land"])
+	machine.get_state("Hop").set_script(load("res://tests/test_hop_state.gd"))
+	var visited: Array[StringName] = []
+	machine.transitioned.connect(func(_from: State, to: State, _input: StateInput) -> void: visited.append(to.state_name))
+	machine.start()
+	check(machine.transition_to("Hop"), "transition to Hop failed")
+	check(visited == [&"Hop", &"Land"], "reentrant transition ran out of order: %s" % [visited])
+	check(machine.get_active_state().state_name == &"Land", "reentrant transition requested in _activate was lost")
+	machine.queue_free()
+
+
+func make_chain(machine: StateMachine, edges: Array) -> void:
+	for edge: Array in edges:
+		var transition := machine.add_transition_between(machine.get_state(edge[0]), machine.get_state(edge[1]))
+		transition.set_script(preload("res://tests/test_always_transition.gd"))
+
+
+func test_chained_transitions_land_in_one_tick() -> void:
+	var machine := make_machine(["Idle", "Alert", "Chase"])
+	make_chain(machine, [["Idle", "Alert"], ["Alert", "Chase"]])
+	machine.max_transitions_per_tick = 4
+	var frames: Array[int] = []
+	machine.transitioned.connect(func(_from: State, _to: State, _input: StateInput) -> void: frames.append(Engine.get_process_frames()))
+	machine.start("Idle")
+	await wait(0.1)
+	check(machine.get_active_state().state_name == &"Chase", "chain did not reach Chase, active state is %s" % machine.get_active_state().state_name)
+	check(frames.size() == 2 and frames[0] == frames[1], "Idle -> Alert -> Chase took more than one tick: %s" % [frames])
+	machine.queue_free()
+
+
+func test_chained_transitions_stop_at_a_loop() -> void:
+	var machine := make_machine(["A", "B"])
+	make_chain(machine, [["A", "B"], ["B", "A"]])
+	machine.max_transitions_per_tick = 16
+	var frames: Array[int] = []
+	machine.transitioned.connect(func(_from: State, _to: State, _input: StateInput) -> void: frames.append(Engine.get_process_frames()))
+	machine.start("A")
+	await get_tree().process_frame
+	await get_tree().process_frame
+	check(frames.size() >= 2 and frames.count(frames[0]) == 2, "A -> B -> A did not stop once it came back to A: %s" % [frames])
+	machine.queue_free()
+
+
+func test_rename_keeps_any_state_transitions() -> void:
+	var machine := make_machine(["Idle", "Walk", "Hurt"])
+	var any := machine.add_any_transition(machine.get_state("Hurt"))
+	any.event = &"hit"
+	any.excluded_states = PackedStringArray(["Walk"])
+	machine.get_state("Hurt").state_name = &"Stunned"
+	machine.get_state("Walk").state_name = &"Run"
+	check(any.get_to_state() == machine.get_state("Stunned"), "any-state transition lost its renamed target")
+	check(any.excluded_states == PackedStringArray(["Run"]), "exclusion was not renamed: %s" % [any.excluded_states])
+
+	machine.start("Run")
+	check(not machine.send_event(&"hit"), "any-state transition fired from an excluded, renamed state")
+	machine.transition_to("Idle")
+	check(machine.send_event(&"hit"), "any-state transition into a renamed state did not fire")
+	check(machine.get_active_state().state_name == &"Stunned", "any-state transition landed in the wrong state")
+	machine.queue_free()
+
+
+func test_clearing_graph_keeps_states() -> void:
+	var graph := StateMachineGraph.new()
+	var machine := make_machine(["Idle", "Walk"])
+	var transition := machine.add_transition_between(machine.get_state("Idle"), machine.get_state("Walk"))
+	transition.event = &"go"
+	machine.add_any_transition(machine.get_state("Idle"))
+	machine.graph = graph
+	machine.per_instance_states = true
+	var copy := machine.get_state("Idle")
+
+	machine.graph = null
+	check(machine.get_all_state_names() == PackedStringArray(["Idle", "Walk"]), "clearing the graph dropped the states")
+	check(machine.get_state("Idle") == copy, "clearing the graph did not keep the per-instance copy")
+	check(machine.get_state("Walk").get_state_machine() == machine, "kept state is not owned by the machine")
+	check(machine.get_state("Walk") != graph.get_all_states()[1], "kept state is still shared with the graph")
+	check(machine.get_any_transitions().size() == 1, "clearing the graph dropped the any-state transitions")
+	check(graph.get_all_states().size() == 2, "clearing the graph emptied it")
+	machine.start("Idle")
+	check(machine.send_event(&"go") and machine.get_active_state().state_name == &"Walk", "kept transition does not fire")
+	machine.queue_free()
+
+
+func test_disabling_shared_state_stays_per_instance() -> void:
+	var graph := StateMachineGraph.new()
+	var first := make_machine(["Idle", "Guard", "Walk"])
+	first.get_state("Guard").set_script(preload("res://tests/test_lock_state.gd"))
+	first.graph = graph
+	var second := make_machine([])
+	second.graph = graph
+
+	first.start("Guard")
+	second.start("Idle")
+	check(not first.transition_to("Walk"), "a state disabled from a callback still activates")
+	check(second.transition_to("Walk"), "a callback of one machine disabled the shared state for every machine")
+	check(graph.get_all_states()[2].enabled, "a callback changed the graph's own state")
+	first.queue_free()
+	second.queue_free()
+
+
+func test_machine_with_copies_still_publishes() -> void:
+	var graph := StateMachineGraph.new()
+	var first := make_machine(["Idle", "Walk"])
+	first.graph = graph
+	first.per_instance_states = true
+	var second := make_machine([])
+	second.graph = graph
+	first.get_state("Idle")
+
+	first.add_state("Hurt")
+	check(second.has_state("Hurt"), "a state added by a machine holding copies did not reach the graph")
+	first.remove_state(first.get_state("Walk"))
+	check(not second.has_state("Walk"), "a copy removed by its machine stayed in the graph")
+	graph.get_all_states()[0].state_name = &"Rest"
+	check(first.has_state("Rest") and first.get_state("Rest").state_name == &"Rest", "renaming the template did not rename the copy")
+	check(second.has_state("Rest"), "renaming the template did not reach the other instance")
+	first.queue_free()
+	second.queue_free()
+
+
+func test_per_instance_states_are_distinct() -> void:
+	var graph := StateMachineGraph.new()
+	var first := make_machine(["Idle", "Walk"])
+	var transition := first.add_transition_between(first.get_state("Idle"), first.get_state("Walk"))
+	transition.event = &"go"
+	first.graph = graph
+	first.per_instance_states = true
+	var second := make_machine([])
+	second.graph = graph
+	second.per_instance_states = true
+
+	var template: State = graph.get_all_states()[0]
+	var first_idle := first.get_state("Idle")
+	var second_idle := second.get_state("Idle")
+	check(first_idle != second_idle and first_idle != template and second_idle != template, "instances share a state")
+	var first_transition: StateTransition = first_idle.get_all_transitions()[0]
+	var second_transition: StateTransition = second_idle.get_all_transitions()[0]
+	check(first_transition != second_transition and first_transition != transition, "instances share a transition")
+	check(first_transition.get_from_state() == first_idle, "copied transition does not start from the copy")
+	check(second_transition.get_from_state() == second_idle, "copied transition does not start from the copy")
+	check(transition.get_from_state() == template, "materializing a state re-parented the template's transition")
+
+	first.start("Idle")
+	second.start("Idle")
+	check(first.send_event(&"go") and first.get_active_state().state_name == &"Walk", "copied transition does not fire")
+	check(second.get_active_state().state_name == &"Idle", "one instance's transition moved another")
+	first.queue_free()
+	second.queue_free()
+
+
+func test_add_transitions_matches_single_edges() -> void:
+	var machine := make_machine(["Idle", "Walk", "Run"])
+	var idle := machine.get_state("Idle")
+	var changes := [0]
+	idle.changed.connect(func() -> void: changes[0] += 1)
+	var added := machine.add_transitions(PackedInt32Array([0, 1, 0, 2, 0, 1, 1, 1]))
+	check(added.size() == 2, "duplicate or self edges were added: %d" % added.size())
+	check(changes[0] == 1, "changed was emitted %d times for one batch" % changes[0])
+	check(added[0].get_from_state() == idle and added[0].get_to_state() == machine.get_state("Walk"), "edge was wired to the wrong states")
+	check(machine.add_transition_between(idle, machine.get_state("Run")) == added[1], "single-edge API did not find the batched transition")
+
+	machine.get_state("Walk").allow_transition_to_self(true)
+	check(machine.add_transitions(PackedInt32Array([1, 1])).size() == 1, "self edge was refused on a state allowing it")
+
+	added[1].event = &"run"
+	machine.start("Idle")
+	check(machine.send_event(&"run") and machine.get_active_state().state_name == &"Run", "batched transition does not fire")
+	machine.queue_free()
+
+
+func test_duplicated_state_owns_its_transitions() -> void:
+	var machine := make_machine(["Idle", "Walk"])
+	var idle := machine.get_state("Idle")
+	var transition := machine.add_transition_between(idle, machine.get_state("Walk"))
+	var copy: State = idle.duplicate(true)
+	var copied: StateTransition = copy.get_all_transitions()[0]
+	check(copied != transition, "duplicated state shares its transition with the original")
+	check(copied.get_from_state() == copy, "duplicated transition does not start from the copy")
+	check(transition.get_from_state() == idle, "duplicating a state took the original's transition")
+	machine.queue_free()
+
+
+func test_duplicated_machine_owns_its_states() -> void:
+	var machine := make_machine(["Idle", "Walk"])
+	var transition := machine.add_transition_between(machine.get_state("Idle"), machine.get_state("Walk"))
+	transition.event = &"go"
+	var any := machine.add_any_transition(machine.get_state("Idle"))
+	var copy := machine.duplicate() as StateMachine
+	add_child(copy)
+	check(copy.get_state("Idle") != machine.get_state("Idle"), "duplicated machine shares its states")
+	check(copy.get_any_transitions()[0] != any, "duplicated machine shares its any-state transitions")
+	check(machine.get_state("Idle").get_state_machine() == machine, "duplicating a machine took the original's states")
+	check(any.get_state_machine() == machine, "duplicating a machine took the original's any-state transitions")
+	check(copy.get_state("Idle").get_state_machine() == copy, "duplicated state is not owned by the copy")
+
+	copy.start("Idle")
+	check(copy.send_event(&"go") and copy.get_active_state().state_name == &"Walk", "duplicated transition does not fire")
+	check(transition.get_from_state() == machine.get_state("Idle"), "original transition was re-parented")
+	copy.queue_free()
+	machine.queue_free()
+
+
+func test_packed_scene_round_trip() -> void:
+	var machine := make_machine(["Idle", "Walk", "Hurt"])
+	var transition := machine.add_transition_between(machine.get_state("Idle"), machine.get_state("Walk"))
+	transition.event = &"go"
+	var any := machine.add_any_transition(machine.get_state("Hurt"))
+	any.event = &"hit"
+	any.excluded_states = PackedStringArray(["Walk"])
+	machine.default_state = machine.get_state("Walk")
+
+	var scene := PackedScene.new()
+	check(scene.pack(machine) == OK, "machine could not be packed")
+	check(ResourceSaver.save(scene, "user://ezfsm_round_trip.tscn") == OK, "packed machine could not be saved")
+	machine.queue_free()
+
+	var loaded := ResourceLoader.load("user://ezfsm_round_trip.tscn", "", ResourceLoader.CACHE_MODE_IGNORE) as PackedScene
+	var first := loaded.instantiate() as StateMachine
+	var second := loaded.instantiate() as StateMachine
+	add_child(first)
+	add_child(second)
+	check(first.get_all_state_names() == PackedStringArray(["Idle", "Walk", "Hurt"]), "states were not restored: %s" % [first.get_all_state_names()])
+	check(first.default_state.state_name == &"Walk", "default state was not restored")
+	check(first.get_state("Idle") != second.get_state("Idle"), "instances of one scene share their states")
+	check(first.get_any_transitions()[0].excluded_states == PackedStringArray(["Walk"]), "exclusions were not restored")
+
+	first.start("Idle")
+	check(first.send_event(&"go") and first.get_active_state().state_name == &"Walk", "restored transition does not fire")
+	check(not first.send_event(&"hit"), "restored exclusion does not apply")
+	second.start("Idle")
+	check(second.send_event(&"hit") and second.get_active_state().state_name == &"Hurt", "restored any-state transition does not fire")
+	check(first.get_active_state().state_name == &"Walk", "instances of one scene share their state")
+	first.queue_free()
+	second.queue_free()
+
+
+func test_export_import_round_trip() -> void:
+	var machine := make_machine(["Idle", "Walk", "Hurt"])
+	var walk := machine.add_transition_between(machine.get_state("Idle"), machine.get_state("Walk"))
+	walk.event = &"go"
+	walk.timeout = 2.5
+	walk.thread_safe = true
+	machine.add_transition_between(machine.get_state("Idle"), machine.get_state("Hurt"))
+	machine.get_state("Hurt").sleeps_until_event = true
+	machine.get_state("Walk").set_script(preload("res://tests/test_hop_state.gd"))
+	var any := machine.add_any_transition(machine.get_state("Hurt"))
+	any.event = &"hit"
+	any.excluded_states = PackedStringArray(["Walk"])
+	machine.default_state = machine.get_state("Walk")
+	var data := machine.export_graph()
+
+	var copy := make_machine(["Other"])
+	check(copy.import_graph(data) == OK, "exported graph could not be imported")
+	check(copy.get_all_state_names() == PackedStringArray(["Idle", "Walk", "Hurt"]), "states were not imported: %s" % [copy.get_all_state_names()])
+	check(copy.default_state.state_name == &"Walk", "default state was not imported")
+	var transitions := copy.get_state("Idle").get_all_transitions()
+	check(transitions.size() == 2 and transitions[0].get_to_state() == copy.get_state("Walk"), "transitions were not imported in priority order")
+	check(transitions[0].event == &"go" and transitions[0].timeout == 2.5 and transitions[0].thread_safe, "transition properties were not imported")
+	check(copy.get_state("Hurt").sleeps_until_event, "state flags were not imported")
+	check(copy.get_state("Walk").get_script() == preload("res://tests/test_hop_state.gd"), "state script was not imported")
+	var imported_any: StateTransition = copy.get_any_transitions()[0]
+	check(imported_any.event == &"hit" and imported_any.excluded_states == PackedStringArray(["Walk"]), "any-state transition was not imported")
+	check(copy.export_graph() == data, "re-exporting the imported graph changed it")
+
+	var unsupported := data.duplicate()
+	unsupported.encode_u32(4, 0)
+	check(copy.import_graph(unsupported) == ERR_FILE_UNRECOGNIZED, "format version 0 was accepted")
+	copy.graph = StateMachineGraph.new()
+	check(copy.import_graph(data) == ERR_UNAVAILABLE, "import rewrote a shared graph")
+	machine.queue_free()
+	copy.queue_free()
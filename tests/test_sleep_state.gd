@@ -0,0 +1,5 @@
+extends State
+
+
+func _activate(_input: StateInput) -> void:
+	get_state_machine().sleep()
@@ -5,9 +5,7 @@ extends StateTransition
 func _physics_process(_delta: float) -> bool:
 	if context:
 		if context.count <= 0:
-			var input := StateInput.new()
-			input.set_meta("TestMetaInput", 42)
-			set_state_input(input)
+			get_state_input().set_meta("TestMetaInput", 42)
 			return true
 		else:
 			return false